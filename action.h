@@ -87,7 +87,7 @@ public:
 	}
 protected:
 	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) slide(*a); }
-	static __attribute__((constructor)) void init() { entries()[type_flag('s')] = new slide; }
+	static __attribute__((constructor)) void init() { static slide proto; entries()[type_flag('s')] = &proto; }
 };
 
 class action::place : public action {
@@ -122,5 +122,5 @@ public:
 	}
 protected:
 	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) place(*a); }
-	static __attribute__((constructor)) void init() { entries()[type_flag('p')] = new place; }
+	static __attribute__((constructor)) void init() { static place proto; entries()[type_flag('p')] = &proto; }
 };
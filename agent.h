@@ -15,9 +15,27 @@
 #include <type_traits>
 #include <algorithm>
 #include <fstream>
+#include <chrono>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <cerrno>
 #include "board.h"
 #include "action.h"
 #include "weight.h"
+#include "pattern.h"
+#include "transposition.h"
+#include "rng.h"
+#include "sync.h"
+#if defined(__unix__)
+#include <dlfcn.h>
+#include <sys/wait.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_GATHER
+#endif
 
 class agent {
 public:
@@ -41,6 +59,58 @@ public:
 	virtual std::string name() const { return property("name"); }
 	virtual std::string role() const { return property("role"); }
 
+public:
+	/**
+	 * the agents are created by their roles and types, e.g., --slide="type=tdl ..." for "slider:tdl",
+	 * where each type is registered to entries() as the prototypes of action
+	 *
+	 * the agents of a shared object given by plugin=path are registered by its function
+	 * extern "C" void threes_agents(agent::registry& entries)
+	 */
+	typedef agent* (*factory)(const std::string& args);
+	typedef std::map<std::string, factory> registry;
+	static registry& entries() { static registry m; return m; }
+
+	static agent* create(const std::string& role, const std::string& args) {
+		agent info(args);
+		if (info.meta.find("plugin") != info.meta.end()) load_plugin(info.meta["plugin"]);
+		std::string type = info.meta.find("type") != info.meta.end() ? info.meta["type"] : std::string();
+		auto proto = entries().find(role + ":" + type);
+		if (proto == entries().end()) {
+			std::cerr << "unknown agent type: " << role << ":" << type << std::endl;
+			std::exit(-1);
+		}
+		agent* a = proto->second(args);
+		a->meta["role"] = { role };
+		a->meta["type"] = { type };
+		return a;
+	}
+	/**
+	 * another agent of the same role and type, e.g., for a thread
+	 */
+	virtual agent* fork(const std::string& args) const { return create(role(), "type=" + property("type") + " " + args); }
+
+	static void load_plugin(const std::string& path) {
+#if defined(__unix__)
+		static std::map<std::string, void*> loaded;
+		if (loaded.find(path) != loaded.end()) return;
+		void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+		void* enroll = handle ? dlsym(handle, "threes_agents") : nullptr;
+		if (!enroll) {
+			std::cerr << "cannot load plugin: " << path << " (" << dlerror() << ")" << std::endl;
+			std::exit(-1);
+		}
+		reinterpret_cast<void (*)(registry&)>(enroll)(entries());
+		loaded[path] = handle; // never unloaded, as its agents may be alive
+#else
+		std::cerr << "plugins are not supported: " << path << std::endl;
+		std::exit(-1);
+#endif
+	}
+
+	template<typename type>
+	static agent* make(const std::string& args) { return new type(args); }
+
 protected:
 	typedef std::string key;
 	struct value {
@@ -54,18 +124,50 @@ protected:
 
 /**
  * base agent for agents with randomness
+ * the engine is seeded by seed, and its algorithm is selected by rng=xoshiro|pcg (see random_engine)
  */
 class random_agent : public agent {
 public:
 	random_agent(const std::string& args = "") : agent(args) {
-		if (meta.find("seed") != meta.end())
-			engine.seed(int(meta["seed"]));
+		std::string algo = meta.find("rng") != meta.end() ? meta["rng"] : std::string("xoshiro");
+		uint64_t seed = meta.find("seed") != meta.end() ? std::stoull(meta["seed"]) : random_engine::default_seed;
+		if (!engine.seed(seed, algo)) {
+			std::cerr << "unknown rng: " << algo << std::endl;
+			std::exit(-1);
+		}
 	}
 	virtual ~random_agent() {}
 
+	/**
+	 * the engine is reseeded by notify("seed=..."), e.g., for each game of an evaluation
+	 */
+	virtual void notify(const std::string& msg) {
+		agent::notify(msg);
+		if (msg.compare(0, 5, "seed=") == 0) engine.seed(std::stoull(meta["seed"]));
+	}
+
 protected:
-	std::default_random_engine engine;
+	random_engine engine;
+};
+
+#if defined(HAVE_AVX2_GATHER)
+/**
+ * the vectors and the masked gather of 4 or 8 lanes, for the AVX2 kernel of weight_agent
+ */
+template<unsigned lanes> struct avx2_gather;
+template<> struct avx2_gather<4> {
+	typedef __m128 vector;
+	typedef __m128i index;
+	__attribute__((target("avx2")))
+	static vector gather(const float* base, index idx, vector mask) { return _mm_mask_i32gather_ps(_mm_setzero_ps(), base, idx, mask, 4); }
 };
+template<> struct avx2_gather<8> {
+	typedef __m256 vector;
+	typedef __m256i index;
+	__attribute__((target("avx2")))
+	static vector gather(const float* base, index idx, vector mask) { return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), base, idx, mask, 4); }
+};
+#endif
 
 /**
  * base agent for agents with weight tables and a learning rate
@@ -74,138 +176,698 @@ class weight_agent : public agent {
 public:
 	weight_agent(const std::string &args = "") : agent(args), alpha(0.0125), opcode({0, 1, 2, 3})
 	{
+		init_patterns(meta.find("tuples") != meta.end() ? meta["tuples"] : std::string(),
+			meta.find("iso") != meta.end() ? unsigned(meta["iso"]) : 1);
+		if (meta.find("alpha") != meta.end())
+			alpha = float(meta["alpha"]);
+		configure_eval();
+		configure_learning();
+		if (meta.find("optimistic") != meta.end() && meta.find("init") == meta.end()) {
+			std::cerr << "optimistic requires init: " << meta["optimistic"].value << std::endl;
+			std::exit(-1);
+		}
 		if (meta.find("init") != meta.end())
 			init_weights(meta["init"]);
 		if (meta.find("load") != meta.end())
 			load_weights(meta["load"]);
+		if (meta.find("quantize") != meta.end())
+			quantize_weights(meta["quantize"]);
+		if (meta.find("delta") != meta.end())
+			init_delta(meta["delta"]);
+		if (coherent && net.size())
+			interleave_weights();
+		if (meta.find("checkpoint") != meta.end())
+			init_checkpoint(meta["checkpoint"]);
+		if (meta.find("sync") != meta.end())
+			init_sync(meta["sync"]);
+	}
+	/**
+	 * a worker sharing the network of another agent, e.g., for multi-threaded training
+	 * the network is neither initialized, loaded, nor saved by the worker
+	 */
+	weight_agent(const weight_agent& shared, const std::string& args) : agent(args), alpha(shared.alpha), opcode({0, 1, 2, 3})
+	{
+		patterns = shared.patterns;
+		index = shared.index;
+		layout = shared.layout;
+		stages = shared.stages;
+		stride = shared.stride;
+		width = shared.width;
+		mapped = shared.mapped;
+		for (const weight& w : shared.net) net.push_back(w.view());
+		for (const quantized& w : shared.qnet) qnet.push_back(w.view());
+		backup = shared.backup;
+		if (shared.remote) {
+			std::cerr << "sync cannot be used with threads, run a process per thread instead" << std::endl;
+			std::exit(-1);
+		}
+		meta.erase("save");
 		if (meta.find("alpha") != meta.end())
 			alpha = float(meta["alpha"]);
+		configure_eval();
+		configure_learning();
+		if (coherent && width == 1) {
+			std::cerr << "tc requires the main agent to learn with tc" << std::endl;
+			std::exit(-1);
+		}
 	}
 	virtual ~weight_agent() {
+		if (remote && !remote->sync()) std::cerr << "last sync failed: " << meta["sync"].value << std::endl;
+		if (remote) std::cerr << "sync: " << remote->syncs << " syncs, " << remote->pushed << " pushed, "
+			<< remote->pulled << " pulled (" << remote->bytes << " bytes)" << std::endl;
+		if (backup && backup.use_count() == 1) backup->wait();
 		if (meta.find("save") != meta.end())
 			save_weights(meta["save"]);
+		if (meta.find("save") != meta.end() && meta.find("delta") != meta.end())
+			std::remove(meta["delta"].value.c_str()); // merged into the save path
+	}
+	/**
+	 * the weights are also saved every N episodes if checkpoint=N (see checkpoint)
+	 */
+	virtual void close_episode(const std::string& flag = "") {
+		if (remote && ++unsynced >= interval && remote->sync()) unsynced = 0;
+		if (backup && ++backup->episodes % backup->period == 0) checkpoint();
+	}
+	/**
+	 * serve the network as a parameter server (see sync=), until interrupted, which merges the deltas
+	 * by merge=mean|sum (mean by default, see parameter_server)
+	 * a checkpoint of checkpoint=N is made every N syncs
+	 */
+	void serve(const std::string& port) {
+		std::string merge = meta.find("merge") != meta.end() ? meta["merge"] : std::string("mean");
+		if (net.empty() || width > 1 || (merge != "mean" && merge != "sum")) {
+			std::cerr << "invalid serve: " << port << " merge=" << merge << std::endl;
+			std::exit(-1);
+		}
+		parameter_server(net, merge == "mean").serve(port, [this]() { if (backup && ++backup->episodes % backup->period == 0) checkpoint(); });
 	}
+	/**
+	 * a worker of the same kind sharing the network, see the constructor above
+	 */
+	virtual weight_agent* fork(const std::string& args) const { return new weight_agent(*this, args); }
+	float learning_rate() const { return alpha; }
+	/**
+	 * feature indices of an afterstate, i.e., the indices of all the patterns and their isomorphisms,
+	 * ordered by pattern; the capacity allows 8 patterns with 8 isomorphisms each
+	 */
+	static constexpr size_t max_features = 64;
+	typedef std::array<uint32_t, max_features> features;
+
 	virtual action take_action(const board& before){
-		board::reward op_best = -1;
-		board::grid best_state;
+		board::afterstates next = before.after();
+		features tuples[4];
+		float V[4];
+		int legal[4];
+		unsigned num = 0;
+		for (int op : opcode) {
+			if (!next[op].legal()) continue;
+			index_of(next[op].state, tuples[num].data());
+			prefetch(tuples[num]);
+			legal[num++] = op;
+		}
+		get_V(tuples, num, V);
+
+		int op_best = -1, best = -1;
 		float r_V_best = -1.0;
-		    
-		for (int op : opcode)
+		for (unsigned i = 0; i < num; i++)
 		{
-			board tmp = before;
-			board::reward reward = tmp.slide(op);
-			if(reward == -1){
-				continue;
-			}
-			board::reward Fplun = tmp.value();
-			board::reward F = before.value();
-			board::reward Reward = Fplun - F;
-			board::grid state = board(before).state_plun(op);
-			std::vector<int> tuples = get_tuple(state); 
-			float V = get_V(tuples);
-			float r_V = Reward + V;
-			if (r_V > r_V_best)
+			float r_V = next[legal[i]].gain + V[i];
+			if (op_best == -1 || r_V > r_V_best)
 			{
 				r_V_best = r_V;
-				best_state = state;
-				op_best = op;
+				op_best = legal[i];
+				best = i;
 			}
 		}
 
+		if (op_best == -1) {
+			if(train) last_update();
+			train=0;
+			return action();
+		}
+
 		if(train){
 			update_weight(r_V_best);
 		}
-		best_state = board(before).state_plun(op_best);
-		s_tuples = get_tuple(best_state);
-		s_V = get_V(s_tuples);
+		advance(tuples[best], V[best]);
 
-		train=1;
-		 
-		if (op_best != -1)
-			return action::slide(op_best);
-		return action();
-	} 
+		return action::slide(op_best);
+	}
+	/**
+	 * update the last afterstate toward the target, and the afterstates in the trace by lambda^k of the error
+	 */
 	void update_weight(const float st_1_r_V){
-		for (int i = 0; i < 8; i++)
-		{
-			net[i][s_tuples[i]] = net[i][s_tuples[i]] + alpha * (st_1_r_V - s_V);
+		if (alpha == 0) return; // the tables may be read-only
+		float error = st_1_r_V - s_V;
+		counters::update(std::fabs(alpha * error));
+		if (!coherent && !traced && !remote) {
+			float delta = alpha * error;
+			for (size_t n = 0; n < layout.size(); n++) {
+				weight& w = net[layout[n]];
+				w.store(s_tuples[n], w.load(s_tuples[n]) + delta);
+			}
+			return;
+		}
+		update_weight(s_tuples, error);
+		float decay = 1;
+		for (size_t k = 1; k <= traced; k++) {
+			decay *= lambda;
+			update_weight(trace[(head + trace.size() - k) % trace.size()], error * decay);
 		}
 	}
 	void last_update(){
-		for (int i = 0; i < 8; i++)
-		{
-			net[i][s_tuples[i]] = net[i][s_tuples[i]] + alpha * (0 - s_V);
-		}
-	}
-	float get_V(const std::vector<int>tuples){
-		 float result=0;
-		 for(int i=0;i<8;i++){
-			 result += net[i][tuples[i]];
-		 }
-		 return result;
-	 }
-	std::vector<int> get_tuple(const board::grid state){
-		 std::vector<int> tuples;
-		 std::vector<int> col1;
-		 std::vector<int> col2;
-		 std::vector<int> col3;
-		 std::vector<int> col4;
-		 for(int i=0;i<4;i++){
-			 board::row row = state[i];
-			 int a = row[0];
-			 col1.emplace_back(a);
-			 int b = row[1];
-			 col2.emplace_back(b);
-			 int c = row[2];
-			 col3.emplace_back(c);
-			 int d = row[3];
-			 col4.emplace_back(d);
-			 tuples.emplace_back(16*16*16*a + 16*16*b + 16*c + d);
-		 }
-		 tuples.emplace_back(16*16*16*col1[0] + 16*16*col1[1] + 16*col1[2] + col1[3]);
-		 tuples.emplace_back(16*16*16*col2[0] + 16*16*col2[1] + 16*col2[2] + col2[3]);
-		 tuples.emplace_back(16*16*16*col3[0] + 16*16*col3[1] + 16*col3[2] + col3[3]);
-		 tuples.emplace_back(16*16*16*col4[0] + 16*16*col4[1] + 16*col4[2] + col4[3]);
-		 return tuples;
-	 }
- 
+		update_weight(0);
+		traced = 0;
+	}
+	float get_V(const features& tuples) const {
+		counters::eval(1);
+		return qnet.size() ? sum(qnet, tuples) : sum(net, tuples);
+	}
+	/**
+	 * the values of up to 4 candidates at once, so that all their lookups are in flight together,
+	 * by scalar loads, or by AVX2 gathers (one per feature, across the candidates) if eval=gather and
+	 * the CPU supports them; the sums are in the same order as the single version
+	 *
+	 * gathers are opt-in since they are slower than scalar loads on CPUs with microcoded gathers,
+	 * e.g., Intel CPUs with the gather data sampling mitigation
+	 */
+	void get_V(const features* tuples, unsigned num, float* V) const {
+		counters::eval(num);
+		if (qnet.size()) return sum(qnet, tuples, num, V);
+#if defined(HAVE_AVX2_GATHER)
+		if (gather && num > 1) return sum_avx2<4>(tuples, num, V);
+#endif
+		sum(net, tuples, num, V);
+	}
+	/**
+	 * prefetch the entries of a candidate while the next candidates are indexed
+	 */
+	void prefetch(const features& tuples) const {
+		if (qnet.size()) return prefetch(qnet, tuples);
+		prefetch(net, tuples);
+	}
+	features get_tuple(const board& state) const {
+		features tuples;
+		index_of(state, tuples.data());
+		return tuples;
+	}
+	/**
+	 * the values of n afterstates, e.g., to score the logged boards of episodes, without the
+	 * learning state, so it can be called by any threads at once (while training, the values
+	 * may mix the old and the new entries, as take_action does)
+	 *
+	 * the boards are indexed and prefetched in blocks, then the entries of a block are summed
+	 * table by table, i.e., the lookups of a table are issued together, by scalar loads, or by
+	 * AVX2 gathers of 8 boards at once if eval=gather and the CPU supports them (see get_V)
+	 */
+	void evaluate(const board* boards, size_t n, float* out) const {
+		static constexpr unsigned block = 16;
+		features tuples[block];
+		counters::eval(n);
+		for (size_t k = 0; k < n; k += block) {
+			unsigned num = std::min<size_t>(block, n - k);
+			for (unsigned i = 0; i < num; i++) {
+				index_of(boards[k + i], tuples[i].data());
+				prefetch(tuples[i]);
+			}
+			if (qnet.size()) sum(qnet, tuples, num, out + k);
+#if defined(HAVE_AVX2_GATHER)
+			else if (gather) for (unsigned i = 0; i < num; i += 8) sum_avx2<8>(tuples + i, std::min(num - i, 8u), out + k + i);
+#endif
+			else sum(net, tuples, num, out + k);
+		}
+	}
+	std::vector<float> evaluate(const std::vector<board>& boards) const {
+		std::vector<float> values(boards.size());
+		evaluate(boards.data(), boards.size(), values.data());
+		return values;
+	}
 
 protected:
+	/**
+	 * the sums of the entries of the candidates in the tables, which are either weight or quantized
+	 */
+	template<typename table>
+	float sum(const std::vector<table>& tables, const features& tuples) const {
+		float result = 0;
+		for (size_t n = 0; n < layout.size(); n++)
+			result += tables[layout[n]].load(tuples[n]);
+		return result;
+	}
+	template<typename table>
+	void sum(const std::vector<table>& tables, const features* tuples, unsigned num, float* V) const {
+		std::fill(V, V + num, 0);
+		for (size_t n = 0; n < layout.size(); n++) {
+			const table& w = tables[layout[n]];
+			for (unsigned i = 0; i < num; i++) V[i] += w.load(tuples[i][n]);
+		}
+	}
+	template<typename table>
+	void prefetch(const std::vector<table>& tables, const features& tuples) const {
+		for (size_t n = 0; n < layout.size(); n++)
+			__builtin_prefetch(tables[layout[n]].data() + tuples[n]);
+	}
+	/**
+	 * the feature indices of a board in the tables of its stage, where stage k > 0 is the boards whose
+	 * max tile is at least the k-th threshold, and its entries follow those of stage k - 1 in each table
+	 */
+	void index_of(const board& state, uint32_t* tuples) const {
+		index(state, tuples);
+		if (stages.size() && state.reach(stages[0])) {
+			unsigned stage = 1;
+			while (stage < stages.size() && state.reach(stages[stage])) stage++;
+			for (size_t n = 0; n < layout.size(); n++) tuples[n] += stage * stride[n];
+		}
+		if (width > 1)
+			for (size_t n = 0; n < layout.size(); n++) tuples[n] *= width;
+	}
+	/**
+	 * the afterstate to be updated by the next TD error, where the previous one is pushed to the trace
+	 */
+	void advance(const features& tuples, float V) {
+		if (train && trace.size()) {
+			trace[head] = s_tuples;
+			head = (head + 1) % trace.size();
+			traced = std::min(traced + 1, trace.size());
+		}
+		s_tuples = tuples;
+		s_V = V;
+		train = 1;
+	}
+	/**
+	 * update the entries of an afterstate by an error, where the rate of each entry is scaled by
+	 * its temporal coherence |E| / A if tc is on, i.e., the sum of its errors over the sum of their magnitudes,
+	 * where E and A follow the entry in its table (see interleave_weights)
+	 */
+	void update_weight(const features& tuples, float error) {
+		for (size_t n = 0; n < layout.size(); n++) {
+			weight& w = net[layout[n]];
+			if (remote) remote->touch(layout[n], tuples[n] / width, w.load(tuples[n]));
+			if (coherent) {
+				size_t i = tuples[n];
+				float E = w.load(i + 1), A = w.load(i + 2);
+				float rate = A > 0 ? std::fabs(E) / A : 1;
+				w.store(i, w.load(i) + alpha * rate * error);
+				w.store(i + 1, E + error);
+				w.store(i + 2, A + std::fabs(error));
+			} else {
+				w.store(tuples[n], w.load(tuples[n]) + alpha * error);
+			}
+		}
+	}
+
+
+	/**
+	 * the learning is TD(0) by default, or TD(lambda) over the last trace afterstates (5 by default) if lambda
+	 * is given, optionally with the temporal coherence (TC) learning rates if tc is given
+	 * the TC accumulators are not saved, i.e., they restart with each run
+	 */
+	void configure_learning() {
+		lambda = meta.find("lambda") != meta.end() ? float(meta["lambda"]) : 0;
+		size_t length = meta.find("trace") != meta.end() ? size_t(meta["trace"]) : (lambda ? 5 : 1);
+		trace.assign(lambda ? std::max<size_t>(length, 1) - 1 : 0, features());
+		head = traced = 0;
+		coherent = meta.find("tc") != meta.end() && meta["tc"].value != "0";
+	}
+	void configure_eval() {
+		gather = false;
+#if defined(HAVE_AVX2_GATHER)
+		if (meta.find("eval") != meta.end() && meta["eval"].value == "gather")
+			gather = __builtin_cpu_supports("avx2");
+#endif
+	}
+#if defined(HAVE_AVX2_GATHER)
+	/**
+	 * the values of up to lanes (4 or 8) candidates by AVX2 gathers, one per feature across the candidates
+	 */
+	template<unsigned lanes>
+	__attribute__((target("avx2")))
+	void sum_avx2(const features* tuples, unsigned num, float* V) const {
+		typedef avx2_gather<lanes> simd;
+		alignas(32) int32_t lane[lanes];
+		for (unsigned i = 0; i < lanes; i++) lane[i] = i < num ? -1 : 0;
+		typename simd::vector mask, sum = typename simd::vector();
+		std::memcpy(&mask, lane, sizeof(mask));
+		for (size_t n = 0; n < layout.size(); n++) {
+			for (unsigned i = 0; i < lanes; i++) lane[i] = i < num ? tuples[i][n] : 0;
+			typename simd::index idx;
+			std::memcpy(&idx, lane, sizeof(idx));
+			sum += simd::gather(net[layout[n]].data(), idx, mask);
+		}
+		float out[lanes];
+		std::memcpy(out, &sum, sizeof(sum));
+		std::copy(out, out + num, V);
+	}
+#endif
+
+	/**
+	 * patterns are given as semicolon-separated cell lists, e.g., "0,1,2,3,4,5;4,5,6,7,8,9",
+	 * where each pattern is expanded to its 8 isomorphisms if iso=8
+	 * the 4 rows and the 4 columns are used if no pattern is given
+	 */
+	virtual void init_patterns(const std::string& info, unsigned iso) {
+		if (iso != 1 && iso != 8) {
+			std::cerr << "invalid iso: " << iso << std::endl;
+			std::exit(-1);
+		}
+		patterns = info.size() ? pattern::parse(info, iso) : indexer::rows_and_columns::patterns();
+		index = indexer(patterns);
+		layout.clear();
+		for (size_t i = 0; i < patterns.size(); i++)
+			layout.insert(layout.end(), patterns[i].isomorphism(), i);
+		if (patterns.empty() || layout.size() > max_features) {
+			std::cerr << "invalid tuples: " << info << std::endl;
+			std::exit(-1);
+		}
+		init_stages(meta.find("stage") != meta.end() ? meta["stage"] : std::string());
+	}
+	/**
+	 * stages are given as comma-separated ascending tile thresholds, e.g., "192,768" for 3 stages,
+	 * i.e., the boards whose max tile is less than 192, less than 768, and the others
+	 * each stage has a separate set of tables, i.e., the tables are (thresholds + 1) times larger
+	 */
+	virtual void init_stages(const std::string& info) {
+		stages.clear();
+		std::stringstream in(info);
+		for (std::string tile; std::getline(in, tile, ','); ) {
+			unsigned t = board::ttoi(std::stoul(tile));
+			if (t == 0 || t > 15 || board::itot(t) != std::stoul(tile) || (stages.size() && t <= stages.back())) {
+				std::cerr << "invalid stage: " << info << std::endl;
+				std::exit(-1);
+			}
+			stages.push_back(t);
+		}
+		stride.clear();
+		for (size_t n = 0; n < layout.size(); n++) stride.push_back(patterns[layout[n]].table_size());
+	}
+	size_t table_size(size_t i) const { return patterns[i].table_size() * (stages.size() + 1); }
+	/**
+	 * the tables are allocated by alloc=heap|arena|huge (see arena), where heap is the default
+	 */
+	virtual void allocate_weights() {
+		std::vector<size_t> sizes;
+		for (size_t i = 0; i < patterns.size(); i++) sizes.push_back(table_size(i));
+		net = arena::allocate(sizes, meta.find("alloc") != meta.end() ? meta["alloc"] : std::string("heap"));
+	}
+	/**
+	 * the tables are zero-initialized, or optimistically initialized if optimistic=V is also given, i.e.,
+	 * every afterstate is valued V, where each of its features is valued V / features
+	 * the table sizes are implied by the patterns, so the legacy init=sizes, e.g., "65536,65536" for two 4-tuples,
+	 * is accepted if each size is that of a table, either with all its stages or of one stage
+	 */
 	virtual void init_weights(const std::string& info) {
-		/*std::string res = info; // comma-separated sizes, e.g., "65536,65536"
-		for (char& ch : res)
-			if (!std::isdigit(ch)) ch = ' ';
-		std::stringstream in(res);
-		for (size_t size; in >> size; net.emplace_back(size));*/
-		for(int i=0;i<8;i++){
-			net.emplace_back(65536);
+		allocate_weights();
+		std::vector<size_t> sizes;
+		for (size_t i = 0; i < patterns.size(); i++) sizes.push_back(table_size(i)), sizes.push_back(patterns[i].table_size());
+		bool legacy = true;
+		std::stringstream in(info != "init" ? info : ""); // a bare key is valued by itself
+		for (std::string token; legacy && std::getline(in, token, ','); )
+			legacy = token.find_first_not_of("0123456789") == std::string::npos && token.size() && token.size() < 20
+				&& std::find(sizes.begin(), sizes.end(), std::stoull(token)) != sizes.end();
+		if (!legacy) {
+			std::cerr << "invalid init: " << info << " (the sizes mismatch the tuples, use optimistic=V for an initial value)" << std::endl;
+			std::exit(-1);
 		}
+		float value = meta.find("optimistic") != meta.end() ? float(meta["optimistic"]) : 0;
+		if (value == 0) return;
+		for (weight& w : net) std::fill(w.data(), w.data() + w.size(), value / layout.size());
 	}
+	/**
+	 * weights saved by save_weights are mapped by map=ro|private|shared (see weight_file),
+	 * where ro is the default for alpha=0, and private is the default for training
+	 * weights in the legacy format are read into the tables
+	 */
 	virtual void load_weights(const std::string& path) {
+		if (weight_file::probe(path) && weight_file::probe_format(path) == weight_file::int16) {
+			if (alpha) {
+				std::cerr << "quantized weights cannot be trained: " << path << std::endl;
+				std::exit(-1);
+			}
+			std::vector<weight_file::descriptor> desc;
+			qnet = weight_file::load_quantized(path, desc);
+			bool match = qnet.size() == patterns.size();
+			for (size_t i = 0; match && i < qnet.size(); i++) match = qnet[i].size() == table_size(i);
+			if (!match || desc != describe()) {
+				std::cerr << "weights mismatch the tuples: " << path << std::endl;
+				std::exit(-1);
+			}
+			return;
+		}
+		if (weight_file::probe(path)) {
+			bool write = alpha || meta.find("delta") != meta.end();
+			std::string mode = meta.find("map") != meta.end() ? meta["map"] : std::string(write ? "private" : "ro");
+			if (mode != "ro" && mode != "private" && mode != "shared") {
+				std::cerr << "unknown map: " << mode << std::endl;
+				std::exit(-1);
+			}
+			if (mode == "ro" && write) {
+				std::cerr << "read-only weights cannot be written: " << path << std::endl;
+				std::exit(-1);
+			}
+			std::vector<weight_file::descriptor> desc;
+			net = weight_file::load(path, desc, mode);
+			bool match = net.size() == patterns.size();
+			for (size_t i = 0; match && i < net.size(); i++) match = net[i].size() == table_size(i);
+			if (!match || desc != describe()) {
+				std::cerr << "weights mismatch the tuples: " << path << std::endl;
+				std::exit(-1);
+			}
+			if (mode == "shared") mapped = path;
+			return;
+		}
 		std::ifstream in(path, std::ios::in | std::ios::binary);
 		if (!in.is_open()) std::exit(-1);
 		uint32_t size;
 		in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		if (size == patterns.size()) allocate_weights();
 		net.resize(size);
 		for (weight& w : net) in >> w;
 		in.close();
+		bool match = net.size() == patterns.size();
+		for (size_t i = 0; match && i < net.size(); i++) match = net[i].size() == table_size(i);
+		if (!match) {
+			std::cerr << "weights mismatch the tuples: " << path << std::endl;
+			std::exit(-1);
+		}
 	}
+	/**
+	 * weights mapped by map=shared are flushed in place if saved to the same file
+	 */
 	virtual void save_weights(const std::string& path) {
-		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
-		if (!out.is_open()) std::exit(-1);
-		uint32_t size = net.size();
-		out.write(reinterpret_cast<char*>(&size), sizeof(size));
-		for (weight& w : net) out << w;
-		out.close();
+		if (!write_weights(path)) std::exit(-1);
+	}
+	bool write_weights(const std::string& path) const {
+		return qnet.size() ? weight_file::save(path, qnet, describe())
+			: path == mapped ? weight_file::sync(net) : weight_file::save(path, net, describe(), width);
+	}
+	/**
+	 * the float tables are replaced by 16-bit fixed-point tables with a scale per table if quantize=int16,
+	 * which can only be evaluated (alpha=0), and are saved as such, e.g., to convert a trained file by
+	 * --slide="load=weights.bin alpha=0 quantize=int16 save=weights.q16" --total=0
+	 */
+	virtual void quantize_weights(const std::string& mode) {
+		if (mode != "int16") {
+			std::cerr << "unknown quantization: " << mode << std::endl;
+			std::exit(-1);
+		}
+		if (alpha) {
+			std::cerr << "quantized weights cannot be trained" << std::endl;
+			std::exit(-1);
+		}
+		if (qnet.size()) return; // loaded as quantized
+		for (const weight& w : net) qnet.emplace_back(w);
+		net.clear();
+	}
+	/**
+	 * periodic checkpoints of the weights to the save path, shared by the forked workers
+	 */
+	struct checkpoints {
+		std::string path;
+		size_t period;
+		std::atomic<size_t> episodes;
+		std::mutex lock;
+		std::string delta; // the delta log if delta=path
+		size_t logged = 0, limit = 0; // the bytes in the delta log, and the bytes of the tables
+		bool failed = false; // whether the last checkpoint failed, so the next one is a full one
+		bool based = false; // whether the delta log is based on the save path, otherwise the next one is a full one
+#if defined(__unix__)
+		pid_t saver = 0; // the process writing the last checkpoint
+		bool busy() {
+			return saver > 0 && !reap(WNOHANG);
+		}
+		void wait() {
+			std::lock_guard<std::mutex> guard(lock);
+			if (saver > 0) reap(0);
+		}
+		bool reap(int options) {
+			int status = 0;
+			if (waitpid(saver, &status, options) == 0) return false;
+			failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+			if (failed) std::cerr << "checkpoint failed: " << path << std::endl;
+			saver = 0;
+			return true;
+		}
+#else
+		void wait() {}
+#endif
+	};
+	void init_checkpoint(const std::string& info) {
+		size_t period = std::stoull(info);
+		if (meta.find("save") == meta.end() || period == 0) {
+			std::cerr << "checkpoint requires save and a period: " << info << std::endl;
+			std::exit(-1);
+		}
+		backup = std::make_shared<checkpoints>();
+		backup->path = meta["save"].value;
+		backup->period = period;
+		backup->episodes = 0;
+		if (meta.find("delta") != meta.end()) {
+			backup->delta = meta["delta"].value;
+			for (const weight& w : net) backup->limit += w.size() / width * sizeof(weight::type);
+			// the log goes on only if it was just replayed onto the save path, otherwise it is restarted by a full checkpoint
+			backup->based = replayed && meta["load"].value == backup->path;
+			if (backup->based) backup->logged = size_t(std::ifstream(backup->delta, std::ios::in | std::ios::binary | std::ios::ate).tellg());
+		}
+	}
+	/**
+	 * the checkpoints append the lines updated since the last checkpoint to a delta log at delta=path,
+	 * instead of rewriting the whole save path, where the log is compacted into the save path by a full
+	 * checkpoint once it outgrows the tables (or after a failed checkpoint), and by the final save
+	 * the log is replayed onto the loaded weights, e.g., to resume from the last checkpoint, or to merge
+	 * the log into its base by --total=0 --slide="load=weights.bin delta=weights.delta save=weights.bin"
+	 * a log which is not replayed, e.g., of an init run, is stale, so it is removed
+	 */
+	void init_delta(const std::string& path) {
+		if (net.empty()) {
+			std::cerr << "delta requires the float weights: " << path << std::endl;
+			std::exit(-1);
+		}
+		replayed = meta.find("load") != meta.end() && std::ifstream(path).good();
+		if (replayed && !weight_file::apply_delta(path, net)) {
+			std::cerr << "delta mismatches the weights: " << path << std::endl;
+			std::exit(-1);
+		}
+		if (!replayed) std::remove(path.c_str());
+		for (weight& w : net) w.track();
+	}
+	/**
+	 * the TC accumulators E and A of an entry are interleaved with it, i.e., entry i of a table is at 4 * i,
+	 * followed by its E and A (and a pad), so that an update touches a single cache line, where the indices
+	 * of the features are scaled by the width (see index_of), and the tables are saved as dense ones
+	 */
+	void interleave_weights() {
+		if (mapped.size()) {
+			std::cerr << "tc cannot be used with map=shared" << std::endl;
+			std::exit(-1);
+		}
+		std::vector<size_t> sizes;
+		for (const weight& w : net) sizes.push_back(w.size() * 4);
+		if (*std::max_element(sizes.begin(), sizes.end()) > UINT32_MAX) {
+			std::cerr << "tc requires the tables of at most 2^30 entries" << std::endl;
+			std::exit(-1);
+		}
+		std::vector<weight> wide = arena::allocate(sizes, meta.find("alloc") != meta.end() ? meta["alloc"] : std::string("heap"));
+		for (size_t t = 0; t < net.size(); t++) {
+			for (size_t i = 0; i < net[t].size(); i++) wide[t][i * 4] = net[t][i];
+			if (net[t].tracked()) wide[t].track();
+		}
+		net.swap(wide);
+		width = 4;
+	}
+	/**
+	 * save the weights without stalling the training, by a forked process writing its copy-on-write
+	 * snapshot of the tables (to a temporary file which then replaces the save path, see weight_file)
+	 * a checkpoint is skipped if the last one is still being written
+	 * the weights are saved synchronously if fork is not available
+	 */
+	void checkpoint() {
+		std::lock_guard<std::mutex> guard(backup->lock);
+#if defined(__unix__)
+		if (backup->busy()) return;
+#endif
+		// the lines are collected before the snapshot, so the lines updated after it are in the next delta
+		std::vector<std::vector<uint32_t>> lines;
+		for (weight& w : net) lines.push_back(w.collect());
+		bool full = backup->delta.empty() || backup->failed || !backup->based || backup->logged >= backup->limit;
+		for (const std::vector<uint32_t>& l : lines) backup->logged += full ? 0 : l.size() * weight::alignment / width;
+		if (full) backup->logged = 0;
+		backup->failed = false;
+		backup->based = true;
+		// the file is prepared before forking, since only system calls are safe in the child of a multi-threaded process
+		bool flush = full && backup->path == mapped;
+		weight_file::image img = !full ? weight_file::prepare_delta(backup->delta, net, lines, width)
+			: qnet.size() ? weight_file::prepare(backup->path, qnet, describe()) : weight_file::prepare(backup->path, net, describe(), width);
+		const char* delta = full && backup->delta.size() ? backup->delta.c_str() : nullptr;
+		auto save = [&]() -> bool {
+			if (!(flush ? weight_file::sync(net) : weight_file::write(img))) return false;
+			// the log is removed only after the save path is replaced, as it is never replayed onto a newer one
+			return !delta || std::remove(delta) == 0 || errno == ENOENT;
+		};
+#if defined(__unix__)
+		pid_t pid = ::fork();
+		if (pid == 0) _exit(save() ? 0 : 1); // skip the exit handlers of the parent
+		if (pid > 0) {
+			backup->saver = pid;
+			return;
+		}
+#endif
+		if (!save()) std::exit(-1);
+	}
+	/**
+	 * train with the processes syncing with a parameter server at sync=host:port (see serve), where the
+	 * deltas of the updated entries are pushed, and the entries changed by all are pulled, every interval
+	 * episodes (100 by default), encoded by compress=varint|none (varint by default)
+	 * the network is replaced by that of the server when started
+	 */
+	void init_sync(const std::string& address) {
+		interval = meta.find("interval") != meta.end() ? std::max<size_t>(size_t(meta["interval"]), 1) : 100;
+		std::string mode = meta.find("compress") != meta.end() ? meta["compress"] : std::string("varint");
+		if (qnet.size() || net.empty() || (mode != "varint" && mode != "none")) {
+			std::cerr << "invalid sync: " << address << " compress=" << mode << std::endl;
+			std::exit(-1);
+		}
+		remote = std::make_shared<parameter_client>(address, net, mode == "varint", width);
+		if (!remote->sync()) {
+			std::cerr << "cannot sync with the parameter server: " << address << std::endl;
+			std::exit(-1);
+		}
+	}
+	std::vector<weight_file::descriptor> describe() const {
+		std::vector<weight_file::descriptor> desc;
+		for (const pattern& p : patterns) {
+			weight_file::descriptor d = { uint8_t(p.isomorphism()), uint8_t(p.cells().size()), {} };
+			for (size_t i = 0; i < d.length && i < sizeof(d.cell); i++) d.cell[i] = p.cells()[i];
+			desc.push_back(d);
+		}
+		return desc;
 	}
 
 protected:
 	std::vector<weight> net;
+	std::vector<quantized> qnet; // the quantized tables, which replace net if not empty
+	std::shared_ptr<checkpoints> backup; // the checkpoints if checkpoint=N
+	bool replayed = false; // whether the delta log of delta=path is replayed onto the loaded weights
+	std::shared_ptr<parameter_client> remote; // the parameter server if sync=host:port
+	size_t interval = 100, unsynced = 0;
+	std::vector<pattern> patterns;
+	indexer index;
+	std::vector<size_t> layout; // the weight table of each feature
+	std::vector<board::cell> stages; // the tile thresholds of the stages
+	std::vector<uint32_t> stride; // the entries of a stage in the table of each feature
+	std::string mapped; // the file mapped by map=shared
+	bool gather; // evaluate by AVX2 gathers, see get_V
 	float alpha = 0.0125;
 	std::array<int, 4> opcode;
 	float s_V;
 	bool train = 0;
-	std::vector<int> s_tuples;
+	features s_tuples;
+	size_t width = 1; // the floats of an entry, i.e., 4 if the TC accumulators are interleaved with the weights
+	bool coherent = false;
+	float lambda = 0;
+	std::vector<features> trace; // the previous afterstates, in a ring
+	size_t head = 0, traced = 0;
+protected:
+	static __attribute__((constructor)) void init() { entries()["slider:tdl"] = make<weight_agent>; }
 };
 
 /**
@@ -214,36 +876,64 @@ protected:
  */
 class random_placer : public random_agent {
 public:
-	random_placer(const std::string& args = "") : random_agent("name=place role=placer " + args) {
-		spaces[0] = { 12, 13, 14, 15 };
-		spaces[1] = { 0, 4, 8, 12 };
-		spaces[2] = { 0, 1, 2, 3};
-		spaces[3] = { 3, 7, 11, 15 };
-		spaces[4] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
-	}
+	random_placer(const std::string& args = "") : random_agent("name=place role=placer " + args) {}
 
+	/**
+	 * place at an empty cell of the candidate positions uniformly, with the hint tile (or a tile drawn
+	 * from the bag if there is no hint yet), and draw the next hint tile from the remaining bag
+	 * a tile is drawn from the bag with a probability proportional to its count
+	 */
 	virtual action take_action(const board& after) {
-		std::vector<int> space = spaces[after.last()];
-		std::shuffle(space.begin(), space.end(), engine);
-		for (int pos : space) {
-			if (after(pos) != 0) continue;
+		unsigned empty = after.empty_cells() & space_of(after.last());
+		unsigned num = __builtin_popcount(empty);
+		if (num == 0) return action();
 
-			int bag[3], num = 0;
-			for (board::cell t = 1; t <= 3; t++)
-				for (size_t i = 0; i < after.bag(t); i++)
-					bag[num++] = t;
-			std::shuffle(bag, bag + num, engine);
+		for (unsigned k = engine.uniform(num); k; k--) empty &= empty - 1;
+		int pos = __builtin_ctz(empty);
 
-			board::cell tile = after.hint() ?: bag[--num];
-			board::cell hint = bag[--num];
+		unsigned bag[4] = { 0, after.bag(1), after.bag(2), after.bag(3) };
+		board::cell tile = after.hint();
+		if (!tile) tile = draw(bag);
+		board::cell hint = draw(bag);
 
-			return action::place(pos, tile, hint);
-		}
-		return action();
+		return action::place(pos, tile, hint);
+	}
+
+	/**
+	 * the candidate positions of a placement after the last action,
+	 * i.e., the opposite side of the last slide, or anywhere for the initial placements
+	 */
+	static const std::vector<int>& spaces(unsigned last) {
+		static const std::vector<int> space[5] = {
+			{ 12, 13, 14, 15 },
+			{ 0, 4, 8, 12 },
+			{ 0, 1, 2, 3},
+			{ 3, 7, 11, 15 },
+			{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+		};
+		return space[last];
+	}
+	/**
+	 * the same positions as a mask, i.e., bit (pos) is set for each position of spaces(last)
+	 */
+	static unsigned space_of(unsigned last) {
+		static const unsigned mask[5] = { 0xf000, 0x1111, 0x000f, 0x8888, 0xffff };
+		return mask[last];
 	}
 
 private:
-	std::vector<int> spaces[5];
+	/**
+	 * draw a tile from the bag by its count, and remove it from the bag
+	 */
+	board::cell draw(unsigned* bag) {
+		unsigned r = engine.uniform(bag[1] + bag[2] + bag[3]);
+		board::cell t = 1;
+		while (r >= bag[t]) r -= bag[t++];
+		bag[t]--;
+		return t;
+	}
+protected:
+	static __attribute__((constructor)) void init() { entries()["placer:random"] = make<random_placer>; }
 };
 
 /**
@@ -255,17 +945,23 @@ public:
 	random_slider(const std::string& args = "") : random_agent("name=slide role=slider " + args),
 		opcode({ 0, 1, 2, 3 }) {}
 
+	virtual void notify(const std::string& msg) {
+		random_agent::notify(msg);
+		if (msg.compare(0, 5, "seed=") == 0) opcode = {{ 0, 1, 2, 3 }}; // the shuffles depend only on the seed
+	}
+
 	virtual action take_action(const board& before) {
 		std::shuffle(opcode.begin(), opcode.end(), engine);
-		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
-			if (reward != -1) return action::slide(op);
-		}
+		unsigned legal = before.legal_moves();
+		for (int op : opcode)
+			if (legal & (1u << op)) return action::slide(op);
 		return action();
 	}
 
 private:
 	std::array<int, 4> opcode;
+protected:
+	static __attribute__((constructor)) void init() { entries()["slider:random"] = make<random_slider>; }
 };
 
 class my_slider : public agent {
@@ -297,4 +993,185 @@ class my_slider : public agent {
 		}
 	private:
 		std::array<int, 4> opcode;
-};
\ No newline at end of file
+	protected:
+		static __attribute__((constructor)) void init() { entries()["slider:my"] = make<my_slider>; }
+};
+/**
+ * expectimax slider, which searches over the placements with the network as the leaf evaluator
+ *
+ * the chance nodes follow random_placer, i.e., a placement is uniformly at any empty cell of
+ * random_placer::spaces(last), with the hint tile, and is followed by a new hint drawn from the bag
+ * the value of a leaf is the value of its afterstate, so depth=1 plays the same as weight_agent
+ *
+ * the search is iteratively deepened up to depth plies (default 2), where the moves of the root
+ * are ordered by the previous iteration, and an iteration exceeding nodes (leaf evaluations) or
+ * time (milliseconds) is discarded; chance outcomes less likely than prune are evaluated as leaves
+ *
+ * the results of the nodes are cached in a transposition table of tt bytes (e.g., tt=256M, none by default),
+ * which is shared by the forked workers, and its hits and misses are reported when the slider is destroyed
+ * the results depending on pruned outcomes are not cached, as they depend on the probability of the node
+ *
+ * the played moves are trained as weight_agent if alpha is not 0, where the cached results are aged by each
+ * episode, as they are evaluated by the weights before its updates, i.e., the results within an episode may
+ * be slightly stale, as the updates of a few moves barely change the values
+ */
+class expectimax_slider : public weight_agent {
+public:
+	expectimax_slider(const std::string& args = "") : weight_agent(args) {
+		configure();
+		if (meta.find("tt") != meta.end())
+			tt = std::make_shared<transposition>(transposition::parse(meta["tt"]));
+	}
+	expectimax_slider(const expectimax_slider& shared, const std::string& args) : weight_agent(shared, args), tt(shared.tt) {
+		configure();
+	}
+	virtual ~expectimax_slider() {
+		if (tt && hits + misses)
+			std::cerr << "tt: " << tt->size() << " entries, " << hits << " hits, " << misses << " misses, "
+				<< (100.0 * hits / (hits + misses)) << "% hit rate" << std::endl;
+	}
+	virtual weight_agent* fork(const std::string& args) const { return new expectimax_slider(*this, args); }
+	using weight_agent::evaluate; // the batch evaluation, not hidden by the leaf evaluation below
+
+	virtual void open_episode(const std::string& flag = "") {
+		if (tt && alpha) tt->age();
+	}
+	virtual action take_action(const board& before) {
+		int op = search(before);
+		if (op == -1) {
+			if (train) last_update();
+			train = 0;
+			return action();
+		}
+		board::afterstate next = before.after(op);
+		features tuples;
+		index_of(next.state, tuples.data());
+		float V = get_V(tuples);
+		if (train) update_weight(next.gain + V);
+		advance(tuples, V);
+		return action::slide(op);
+	}
+
+	/**
+	 * the best move of a board, or -1 if there is no legal move
+	 */
+	int search(const board& before) {
+		board::afterstates next = before.after();
+		std::array<int, 4> order = opcode;
+		std::array<float, 4> value;
+		int op_best = -1;
+		nodes = 0;
+		abort = false;
+		pruned = false;
+		deadline = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::milli>(msec));
+
+		for (unsigned d = 1; d <= depth; d++) {
+			int op_iter = -1;
+			for (int op : order) {
+				if (!next[op].legal()) continue;
+				value[op] = next[op].gain + expect(next[op].state, d - 1, 1);
+				if (op_iter == -1 || value[op] > value[op_iter]) op_iter = op;
+			}
+			if (abort && d > 1) break;
+			op_best = op_iter;
+			std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+				return next[a].legal() && (!next[b].legal() || value[a] > value[b]);
+			});
+		}
+		return op_best;
+	}
+
+protected:
+	typedef std::chrono::steady_clock clock;
+
+	void configure() {
+		depth = meta.find("depth") != meta.end() ? std::max(unsigned(meta["depth"]), 1u) : 2;
+		limit = meta.find("nodes") != meta.end() ? size_t(meta["nodes"]) : 0;
+		msec = meta.find("time") != meta.end() ? double(meta["time"]) : 0;
+		prune = meta.find("prune") != meta.end() ? float(meta["prune"]) : 0;
+	}
+
+	/**
+	 * the expected value of an afterstate with the remaining plies, reached with probability prob
+	 */
+	float expect(const board& after, unsigned ply, float prob) {
+		if (ply && prob < prune && after.hint()) pruned = true;
+		if (ply == 0 || prob < prune || after.hint() == 0) return evaluate(after);
+		transposition::result res;
+		if (lookup(after, ply, res)) return res.value;
+		unsigned space = after.empty_cells() & random_placer::space_of(after.last());
+		unsigned empty = __builtin_popcount(space), bag = after.bag(1) + after.bag(2) + after.bag(3);
+		if (empty == 0 || bag == 0) return 0;
+
+		bool outer = pruned;
+		pruned = false;
+		float sum = 0;
+		for (; space; space &= space - 1) {
+			int pos = __builtin_ctz(space);
+			for (board::cell hint = 1; hint <= 3; hint++) {
+				unsigned num = after.bag(hint);
+				if (num == 0) continue;
+				board before = after;
+				before.place(pos, after.hint(), hint);
+				sum += num * maximize(before, ply, prob * num / (empty * bag));
+				if (abort) return 0;
+			}
+		}
+		res = { sum / (empty * bag), ply, -1 };
+		if (tt && ply >= 2 && !pruned) tt->store(after, res);
+		pruned = pruned || outer;
+		return res.value;
+	}
+
+	/**
+	 * the value of a board with the remaining plies, which is 0 if there is no legal move
+	 */
+	float maximize(const board& before, unsigned ply, float prob) {
+		transposition::result res;
+		if (lookup(before, ply, res)) return res.value;
+		bool outer = pruned;
+		pruned = false;
+		res = { 0, ply, -1 };
+		for (int op : opcode) {
+			board::afterstate next = before.after(op);
+			if (!next.legal()) continue;
+			float value = next.gain + expect(next.state, ply - 1, prob);
+			if (abort) return 0;
+			if (res.move == -1 || value > res.value) res.value = value, res.move = op;
+		}
+		if (tt && ply >= 2 && !pruned) tt->store(before, res);
+		pruned = pruned || outer;
+		return res.value;
+	}
+
+	bool lookup(const board& b, unsigned ply, transposition::result& res) {
+		if (!tt || ply < 2) return false; // a node of 1 ply is cheaper to evaluate than a cache miss
+		bool hit = tt->find(b, res) && res.depth >= ply;
+		hits += hit;
+		misses += !hit;
+		return hit;
+	}
+
+	float evaluate(const board& after) {
+		features tuples;
+		index_of(after, tuples.data());
+		nodes++;
+		if (limit && nodes > limit) abort = true;
+		if (msec && (nodes & 0xff) == 0 && clock::now() > deadline) abort = true;
+		return get_V(tuples);
+	}
+
+protected:
+	unsigned depth;
+	size_t limit;
+	double msec;
+	float prune;
+	size_t nodes;
+	bool abort;
+	bool pruned = false; // whether the node being searched has pruned outcomes below it
+	clock::time_point deadline;
+	std::shared_ptr<transposition> tt;
+	size_t hits = 0, misses = 0;
+protected:
+	static __attribute__((constructor)) void init() { entries()["slider:expectimax"] = make<expectimax_slider>; }
+};
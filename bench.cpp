@@ -0,0 +1,300 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * bench.cpp: Benchmark suite for the hot paths of Threes!
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistics.h"
+#include "replay.h"
+#include "runner.h"
+
+/**
+ * count every heap allocation of the process
+ */
+static size_t allocs = 0;
+void* operator new(size_t size) {
+	allocs++;
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+/**
+ * the results are printed one per line as tab-separated key=value pairs, e.g.,
+ * bench=board.slide.left	ops=1048576	ns/op=2.31	ops/s=432900432	allocs/op=0
+ * so that the output of different releases can be compared by name
+ */
+struct bench_filter {
+	std::string prefix;
+	bool match(const std::string& name) const { return name.compare(0, prefix.size(), prefix) == 0; }
+} filter;
+
+/**
+ * a sink for the results of the measured code, so that they are not optimized out
+ */
+static volatile uint64_t sink = 0;
+
+void report(const std::string& name, size_t ops, std::chrono::nanoseconds time, size_t alloc) {
+	std::cout << "bench=" << name << "\t";
+	std::cout << "ops=" << ops << "\t";
+	std::cout << "ns/op=" << (time.count() * 1.0 / ops) << "\t";
+	std::cout << "ops/s=" << size_t(ops * 1e9 / std::max<int64_t>(time.count(), 1)) << "\t";
+	std::cout << "allocs/op=" << (alloc * 1.0 / ops) << std::endl;
+}
+
+/**
+ * run a micro-benchmark, which performs one operation per call of func(i) for i in [0, ops)
+ */
+template<typename function>
+void bench(const std::string& name, size_t ops, function func) {
+	if (!filter.match(name)) return;
+	for (size_t i = 0; i < ops / 16; i++) func(i); // warm up
+	size_t before = allocs;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < ops; i++) func(i);
+	auto time = std::chrono::steady_clock::now() - start;
+	report(name, ops, std::chrono::duration_cast<std::chrono::nanoseconds>(time), allocs - before);
+}
+
+/**
+ * play games with a slider and a placer, and measure either the decisions of the slider (per move)
+ * or the whole games (per game)
+ */
+void bench_game(const std::string& name, agent& slide, agent& place, size_t games, bool per_game = false) {
+	if (!filter.match(name)) return;
+	size_t moves = 0, alloc = 0;
+	std::chrono::nanoseconds time(0);
+	auto begin = std::chrono::steady_clock::now();
+	size_t before_game = allocs;
+	for (size_t n = 0; n < games; n++) {
+		episode game;
+		while (true) {
+			agent& who = game.take_turns(slide, place);
+			if (per_game) {
+				if (game.apply_action(who.take_action(game.state())) != true) break;
+				continue;
+			}
+			size_t before = allocs;
+			auto start = std::chrono::steady_clock::now();
+			action move = who.take_action(game.state());
+			if (&who == &slide) {
+				time += std::chrono::steady_clock::now() - start;
+				alloc += allocs - before;
+				moves++;
+			}
+			if (game.apply_action(move) != true) break;
+		}
+	}
+	if (per_game) {
+		auto total = std::chrono::steady_clock::now() - begin;
+		report(name, games, std::chrono::duration_cast<std::chrono::nanoseconds>(total), allocs - before_game);
+	} else {
+		report(name, moves, time, alloc);
+	}
+}
+
+/**
+ * play whole games with the game loop specialized for the agent types,
+ * compared with bench_game of per_game, where every call is virtual
+ */
+template<typename slider, typename placer>
+void bench_runner(const std::string& name, slider& slide, placer& place, size_t games) {
+	if (!filter.match(name)) return;
+	game_runner<slider, placer> runner(slide, place);
+	size_t before = allocs;
+	auto begin = std::chrono::steady_clock::now();
+	for (size_t n = 0; n < games; n++) {
+		episode game;
+		runner.play(game);
+	}
+	auto total = std::chrono::steady_clock::now() - begin;
+	report(name, games, std::chrono::duration_cast<std::chrono::nanoseconds>(total), allocs - before);
+}
+
+/**
+ * a corpus of the boards of random games, i.e., the boards before the slides and the afterstates
+ * before the placements, with the placements of the placer
+ */
+struct corpus {
+	std::vector<board> before, after;
+	std::vector<action> place;
+
+	corpus(size_t games) {
+		random_slider slide("seed=0");
+		random_placer placer("seed=0");
+		for (size_t n = 0; n < games; n++) {
+			episode game;
+			while (true) {
+				agent& who = game.take_turns(slide, placer);
+				action move = who.take_action(game.state());
+				if (&who == &slide) before.push_back(game.state());
+				if (&who == &placer && game.step() >= 9) after.push_back(game.state()), place.push_back(move);
+				if (game.apply_action(move) != true) break;
+			}
+		}
+	}
+};
+
+/**
+ * weight_agent with its learning internals exposed
+ */
+class tdl_agent : public weight_agent {
+public:
+	tdl_agent(const std::string& args) : weight_agent(args) {}
+	void learn_from(const board& after) {
+		s_tuples = get_tuple(after);
+		s_V = get_V(s_tuples);
+	}
+};
+
+int main(int argc, const char* argv[]) {
+	size_t scale = argc > 1 ? std::stoull(argv[1]) : 1000; // games of the macro-benchmarks
+	filter.prefix = argc > 2 ? argv[2] : "";
+	episode::timing(false);
+
+	corpus data(200);
+	size_t num = data.before.size(), ops = std::max<size_t>(scale, 1) * 1024;
+
+	// board
+	const char* dir[] = { "up", "right", "down", "left" };
+	for (unsigned op = 0; op < 4; op++) {
+		bench(std::string("board.slide.") + dir[op], ops, [&](size_t i) {
+			board b = data.before[i % num];
+			sink += b.slide(op) + b.raw();
+		});
+	}
+	bench("board.after", ops, [&](size_t i) {
+		board::afterstates next = data.before[i % num].after();
+		sink += next[0].gain + next[1].gain + next[2].gain + next[3].gain;
+	});
+	bench("board.legal_moves", ops, [&](size_t i) {
+		sink += data.before[i % num].legal_moves();
+	});
+	bench("board.empty_cells", ops, [&](size_t i) {
+		sink += data.after[i % data.after.size()].empty_cells();
+	});
+	bench("board.place", ops, [&](size_t i) {
+		board b = data.after[i % data.after.size()];
+		sink += data.place[i % data.after.size()].apply(b) + b.raw();
+	});
+
+	// weight_agent
+	std::string tuples = "tuples=0,1,2,3,4,5;4,5,6,7,8,9;0,1,2,4,5,6;4,5,6,8,9,10 iso=8";
+	tdl_agent rows("init alpha=0.0025"), six(tuples + " init alpha=0.0025");
+	float values[256];
+	for (tdl_agent* tdl : { &rows, &six }) {
+		std::string net = tdl == &rows ? "rows" : "six";
+		bench("tdl." + net + ".get_tuple", ops, [&](size_t i) {
+			sink += tdl->get_tuple(data.after[i % data.after.size()])[0];
+		});
+		std::vector<weight_agent::features> feat;
+		for (size_t i = 0; i < std::min<size_t>(data.after.size(), 65536); i++) feat.push_back(tdl->get_tuple(data.after[i]));
+		bench("tdl." + net + ".get_V", ops, [&](size_t i) {
+			sink += tdl->get_V(feat[i % feat.size()]);
+		});
+		bench("tdl." + net + ".evaluate", ops, [&](size_t i) {
+			if (i % 256 == 0) tdl->evaluate(data.after.data() + i % (data.after.size() - 256), 256, values);
+			sink += values[i % 256];
+		});
+		bench("tdl." + net + ".update_weight", ops, [&](size_t i) {
+			if (i % 64 == 0) tdl->learn_from(data.after[(i / 64) % data.after.size()]);
+			tdl->update_weight(1);
+		});
+	}
+	{
+		tdl_agent simd(tuples + " init alpha=0 eval=gather");
+		bench("tdl.six.evaluate.gather", ops, [&](size_t i) {
+			if (i % 256 == 0) simd.evaluate(data.after.data() + i % (data.after.size() - 256), 256, values);
+			sink += values[i % 256];
+		});
+		tdl_agent q16(tuples + " init alpha=0 quantize=int16");
+		std::vector<weight_agent::features> feat;
+		for (size_t i = 0; i < std::min<size_t>(data.after.size(), 65536); i++) feat.push_back(q16.get_tuple(data.after[i]));
+		bench("tdl.six.q16.get_V", ops, [&](size_t i) {
+			sink += q16.get_V(feat[i % feat.size()]);
+		});
+	}
+
+	// random_placer
+	random_placer placer("seed=0");
+	bench("place.take_action", ops, [&](size_t i) {
+		sink += placer.take_action(data.after[i % data.after.size()]);
+	});
+
+	// full games
+	random_slider rand_slide("seed=0");
+	random_placer rand_place("seed=0");
+	bench_game("game.random", rand_slide, rand_place, scale, true);
+	bench_runner("game.random.static", rand_slide, rand_place, scale);
+	weight_agent greedy("init alpha=0");
+	bench_game("game.tdl", greedy, rand_place, scale, true);
+	bench_runner("game.tdl.static", greedy, rand_place, scale);
+	weight_agent train("init alpha=0.0025");
+	bench_game("move.tdl.train", train, rand_place, scale);
+	weight_agent train_tc("init alpha=0.1 tc lambda=0.5");
+	bench_game("move.tdl.tc_lambda.train", train_tc, rand_place, scale);
+	weight_agent train6(tuples + " init alpha=0.0025");
+	bench_game("move.tdl.six.train", train6, rand_place, std::max<size_t>(scale / 10, 1));
+	expectimax_slider search("init alpha=0 depth=2");
+	bench_game("move.expectimax.depth2", search, rand_place, std::max<size_t>(scale / 10, 1));
+
+	// log_reader
+	if (filter.match("replay.")) {
+		statistics games(scale + 1, scale + 1, scale + 1); // the block is never reached, so nothing is shown
+		for (size_t n = 0; n < scale; n++) {
+			games.open_episode("benchmark");
+			episode& game = games.back();
+			while (game.apply_action(game.take_turns(rand_slide, rand_place).take_action(game.state())));
+			games.close_episode("end");
+		}
+		std::string path = "bench.replay.bin";
+		{
+			std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+			games.save_binary(out);
+		}
+		log_reader log;
+		bool opened = true;
+		bench("replay.open", std::max<size_t>(scale / 100, 1), [&](size_t i) {
+			opened = log.open(path) && opened;
+			sink += log.size();
+		});
+		std::remove(path.c_str());
+		if (!opened || log.size() != scale) {
+			std::cerr << "cannot open the log: " << path << std::endl;
+			std::exit(-1);
+		}
+		// every seek is checked against the full replay of the recorded moves of its episode
+		for (size_t k = 0; k < scale; k++) {
+			std::vector<action> moves = games.at(k).actions();
+			board b;
+			for (size_t ply = 0; ply <= moves.size(); ply++) {
+				if (log.moves(k) != moves.size() || !(log.state(k, ply) == b) || (ply == moves.size() && !(log.at(k).state() == b))) {
+					std::cerr << "replay mismatches the log: episode " << k << ", ply " << ply << std::endl;
+					std::exit(-1);
+				}
+				if (ply < moves.size()) episode::apply(moves[ply], b);
+			}
+		}
+		bench("replay.state", ops, [&](size_t i) {
+			size_t k = (i * 2654435761u) % log.size();
+			sink += log.state(k, (i * 40503u) % (log.moves(k) + 1)).raw();
+		});
+	}
+	return 0;
+}
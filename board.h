@@ -11,11 +11,14 @@
 #include <array>
 #include <iostream>
 #include <iomanip>
+#include <iterator>
 #include <algorithm>
+#include <cstdint>
 #include <cmath>
+#include "counters.h"
 
 /**
- * array-based board for Threes!
+ * bitboard-based board for Threes!
  *
  * index (1-d form):
  *  (0)  (1)  (2)  (3)
@@ -23,33 +26,101 @@
  *  (8)  (9) (10) (11)
  * (12) (13) (14) (15)
  *
+ * each tile (index value) is packed as a 4-bit nibble of a 64-bit integer,
+ * i.e., tile (i) is stored at bits [4i, 4i+4) and row (r) at bits [16r, 16r+16)
+ *
+ * the grid-based interface (operator (), operator [], begin, end) is kept through proxies
  */
 class board {
 public:
 	typedef uint32_t cell;
 	typedef std::array<cell, 4> row;
 	typedef std::array<row, 4> grid;
+	typedef uint64_t bits;
 	typedef uint64_t data;
 	typedef uint64_t score;
 	typedef int reward;
 
 public:
-	board() : tile(), attr(0) { reset(); }
-	board(const grid& b, data v = 0) : tile(b), attr(v) {}
+	board() : tile(0), attr(0) { reset(); }
+	board(const grid& b, data v = 0) : tile(0), attr(v) { for (unsigned i = 0; i < 16; i++) tile4(i, b[i / 4][i % 4]); }
+	explicit board(bits raw, data v) : tile(raw), attr(v) {}
 	board(const board& b) = default;
 	board& operator =(const board& b) = default;
 
-	operator grid&() { return tile; }
-	operator const grid&() const { return tile; }
-	row& operator [](unsigned i) { return tile[i]; }
-	const row& operator [](unsigned i) const { return tile[i]; }
-	cell& operator ()(unsigned i) { return tile[i / 4][i % 4]; }
-	const cell& operator ()(unsigned i) const { return tile[i / 4][i % 4]; }
+	/**
+	 * proxy of a single tile, which behaves as a cell&
+	 */
+	class cell_ref {
+	public:
+		cell_ref(board& b, unsigned i) : b(b), i(i) {}
+		cell_ref(const cell_ref& r) = default;
+		operator cell() const { return b.tile4(i); }
+		cell_ref& operator =(cell t) { b.tile4(i, t); return *this; }
+		cell_ref& operator =(const cell_ref& r) { return operator =(cell(r)); }
+	private:
+		board& b;
+		unsigned i;
+	};
+
+	/**
+	 * proxy of a row, which behaves as a row&
+	 */
+	class row_ref {
+	public:
+		row_ref(board& b, unsigned r) : b(b), r(r) {}
+		row_ref(const row_ref& r) = default;
+		operator row() const { return const_cast<const board&>(b)[r]; }
+		row_ref& operator =(const row& v) { for (unsigned c = 0; c < 4; c++) b(r * 4 + c) = v[c]; return *this; }
+		cell_ref operator [](unsigned c) { return b(r * 4 + c); }
+		cell operator [](unsigned c) const { return b.tile4(r * 4 + c); }
+	private:
+		board& b;
+		unsigned r;
+	};
+
+	/**
+	 * iterator over the 16 tiles, in the order of the 1-d index
+	 */
+	template<typename owner, typename ref>
+	class basic_iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef cell value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef void pointer;
+		typedef ref reference;
+
+		basic_iterator(owner& b, unsigned i) : b(&b), i(i) {}
+		reference operator *() const { return (*b)(i); }
+		basic_iterator& operator ++() { i++; return *this; }
+		basic_iterator operator ++(int) { basic_iterator it = *this; i++; return it; }
+		bool operator ==(const basic_iterator& it) const { return b == it.b && i == it.i; }
+		bool operator !=(const basic_iterator& it) const { return !(*this == it); }
+	private:
+		owner* b;
+		unsigned i;
+	};
+	typedef basic_iterator<board, cell_ref> iterator;
+	typedef basic_iterator<const board, cell> const_iterator;
 
-	cell* begin() { return &(operator()(0)); }
-	const cell* begin() const { return &(operator()(0)); }
-	cell* end() { return begin() + 16; }
-	const cell* end() const { return begin() + 16; }
+	operator grid() const {
+		grid g;
+		for (unsigned i = 0; i < 16; i++) g[i / 4][i % 4] = tile4(i);
+		return g;
+	}
+	row_ref operator [](unsigned i) { return row_ref(*this, i); }
+	row operator [](unsigned i) const { return {{ tile4(i * 4 + 0), tile4(i * 4 + 1), tile4(i * 4 + 2), tile4(i * 4 + 3) }}; }
+	cell_ref operator ()(unsigned i) { return cell_ref(*this, i); }
+	cell operator ()(unsigned i) const { return tile4(i); }
+
+	iterator begin() { return iterator(*this, 0); }
+	const_iterator begin() const { return const_iterator(*this, 0); }
+	iterator end() { return iterator(*this, 16); }
+	const_iterator end() const { return const_iterator(*this, 16); }
+
+	bits raw() const { return tile; }
+	bits raw(bits b) { bits old = tile; tile = b; return old; }
 
 	data info() const { return attr; }
 	data info(data dat) { data old = attr; attr = dat; return old; }
@@ -58,6 +129,9 @@ private:
 	data info4(size_t i) const { return (info() >> (4 * i)) & 0x0fu; }
 	data info4(size_t i, data dat) { data old = info4(i); info(info() ^ ((old ^ dat) << (4 * i))); return old; }
 
+	cell tile4(size_t i) const { return (tile >> (4 * i)) & 0x0fu; }
+	cell tile4(size_t i, cell t) { cell old = tile4(i); tile ^= bits((old ^ t) & 0x0fu) << (4 * i); return old; }
+
 public:
 	static unsigned itot(unsigned i) { return i >= 3 ? 3 * (1 << (i - 3)) : i; }
 	static unsigned ttoi(unsigned t) { return t >= 3 ? std::log2(t / 3) + 3 : t; }
@@ -86,6 +160,42 @@ public:
 		hint(t);
 		return true;
 	}
+	/**
+	 * whether any tile is at least t (index value), by comparing the 16 tiles at once,
+	 * where each tile is added to 0x80 - t in its own byte, whose high bit is then set iff tile >= t
+	 */
+	bool reach(cell t) const {
+		const bits lo = 0x0f0f0f0f0f0f0f0full, hi = 0x8080808080808080ull;
+		bits bias = (0x80 - std::min<bits>(t, 0x80)) * 0x0101010101010101ull;
+		return (((tile & lo) + bias) | (((tile >> 4) & lo) + bias)) & hi;
+	}
+	/**
+	 * the legal slides as a mask of opcodes, i.e., bit (op) is set iff slide(op) moves any tile,
+	 * by looking up the rows and the columns in the movable table instead of sliding them
+	 * no legal slide means the game is over
+	 */
+	unsigned legal_moves() const {
+		const lookup& lut = lookup::find();
+		bits cols = transpose(tile);
+		unsigned rows = 0, vert = 0;
+		for (unsigned i = 0; i < 4; i++) {
+			rows |= lut.movable[(tile >> (16 * i)) & 0xffff];
+			vert |= lut.movable[(cols >> (16 * i)) & 0xffff];
+		}
+		return ((rows & 1) << 3) | (rows & 2) | (vert & 1) | ((vert & 2) << 1); // left, right, up, down
+	}
+	/**
+	 * the empty cells as a mask of positions, i.e., bit (i) is set iff tile (i) is 0,
+	 * by folding each nibble to its lowest bit and then packing the 16 bits
+	 */
+	unsigned empty_cells() const {
+		bits m = tile | (tile >> 1);
+		m = ~(m | (m >> 2)) & 0x1111111111111111ull;
+		m = (m | (m >> 3)) & 0x0303030303030303ull;
+		m = (m | (m >> 6)) & 0x000f000f000f000full;
+		m = (m | (m >> 12)) & 0x000000ff000000ffull;
+		return (m | (m >> 24)) & 0xffff;
+	}
 	unsigned value() const {
 		score v = 0;
 		for (cell t : *this) v += board::itov(t);
@@ -116,7 +226,7 @@ public:
 		last(4);
 		return itov(tile);
 	}
-	grid get_tile(){return tile;}
+	grid get_tile(){return *this;}
 	/**
 	 * apply an action to the board
 	 * return the reward of the action, or -1 if the action is illegal
@@ -130,102 +240,35 @@ public:
 		case 3: r = slide_left(); break;
 		}
 		if (r != -1) last(opcode & 0b11);
+		counters::slide(r != -1);
 		return r;
 	}
+
+	/**
+	 * slide a copy of the board, and return the resulting board together with its reward
+	 * afterstates() does the same for all the four actions, indexed by opcode
+	 */
+	struct afterstate;
+	typedef std::array<afterstate, 4> afterstates;
+	afterstate after(unsigned opcode) const;
+	afterstates after() const;
+
 	//reward utility_function(reward t0){}
 	reward slide_left() {
-		bool moved = false;
-		reward score = 0;
-		for (int r = 0; r < 4; r++) {
-			auto& row = tile[r];
-			for (int c = 1; c < 4; c++) {
-				auto& t0 = row[c - 1];
-				auto& t1 = row[c];
-				if (t0 == 0) {
-					t0 = t1;
-					t1 = 0;
-					moved |= (t0 != 0);
-				} else if (t1 != 0 && ((t0 + t1 == 3) || (t0 == t1 && t0 >= 3 && t0 < 14))) {
-					t0 = std::max(t0, t1) + 1;
-					t1 = 0;
-					score += itov(t0) - itov(t0 - 1) * 2;
-					moved = true; 
-				}
-			}
-		}
-		return (moved) ? score : -1;
+		const lookup& lut = lookup::find();
+		return slide_rows(lut.left, lut.score_left);
 	}
 	reward slide_right() {
-		reflect_horizontal();
-		reward score = slide_left();
-		reflect_horizontal();
-		return score;
+		const lookup& lut = lookup::find();
+		return slide_rows(lut.right, lut.score_right);
 	}
 	reward slide_up() {
-		rotate_clockwise();
-		reward score = slide_right();
-		rotate_counterclockwise();
-		return score;
+		const lookup& lut = lookup::find();
+		return slide_cols(lut.up, lut.score_left);
 	}
 	reward slide_down() {
-		rotate_clockwise();
-		reward score = slide_left();
-		rotate_counterclockwise();
-		return score;
-	}
-	grid state_plun(unsigned opcode){
-		grid output;
-		switch (opcode & 0b11) {
-		case 0: output = state_up(); break;
-		case 1: output = state_right(); break;
-		case 2: output = state_down(); break;
-		case 3: output = state_left(); break;
-		}
-		return output;
-	}
-	grid state_left(){
-		grid output;
-		for (int r = 0; r < 4; r++)
-		{
-			auto &row = tile[r];
-			for (int c = 1; c < 4; c++)
-			{
-				auto &t0 = row[c - 1];
-				auto &t1 = row[c];
-				if (t0 == 0)
-				{
-					t0 = t1;
-					t1 = 0;
-				}
-				else if (t1 != 0 && ((t0 + t1 == 3) || (t0 == t1 && t0 >= 3 && t0 < 14)))
-				{
-					t0 = std::max(t0, t1) + 1;
-					t1 = 0;
-				}
-			}
-			output[r] = row;
-		}
-		return output;
-	}
-	grid state_right(){
-		reflect_horizontal();
-		grid output = state_left();
-		reflect_horizontal();
-		return output;
-	}
-	grid state_up()
-	{
-		rotate_clockwise();
-		grid output = state_left();
-		rotate_counterclockwise();
-		return output;
-	}
-	grid state_down()
-	{
-		rotate_clockwise();
-		grid output = state_left();
-		rotate_counterclockwise();
-		return output;
+		const lookup& lut = lookup::find();
+		return slide_cols(lut.down, lut.score_right);
 	}
 	void rotate(int clockwise_count = 1) {
 		switch (((clockwise_count % 4) + 4) % 4) {
@@ -242,32 +285,118 @@ public:
 	void reverse() { reflect_horizontal(); reflect_vertical(); }
 
 	void reflect_horizontal() {
-		for (int r = 0; r < 4; r++) {
-			std::swap(tile[r][0], tile[r][3]);
-			std::swap(tile[r][1], tile[r][2]);
-		}
+		tile = ((tile & 0x000f000f000f000full) << 12) | ((tile & 0x00f000f000f000f0ull) << 4)
+		     | ((tile & 0x0f000f000f000f00ull) >> 4) | ((tile & 0xf000f000f000f000ull) >> 12);
 	}
 
 	void reflect_vertical() {
-		for (int c = 0; c < 4; c++) {
-			std::swap(tile[0][c], tile[3][c]);
-			std::swap(tile[1][c], tile[2][c]);
-		}
+		tile = ((tile & 0x000000000000ffffull) << 48) | ((tile & 0x00000000ffff0000ull) << 16)
+		     | ((tile & 0x0000ffff00000000ull) >> 16) | ((tile & 0xffff000000000000ull) >> 48);
 	}
 
 	void transpose() {
-		for (int r = 0; r < 4; r++) {
-			for (int c = r + 1; c < 4; c++) {
-				std::swap(tile[r][c], tile[c][r]);
-			}
+		tile = transpose(tile);
+	}
+
+private:
+	/**
+	 * swap tile (r, c) with tile (c, r) of a packed board
+	 */
+	static bits transpose(bits x) {
+		bits a = (x & 0xf0f00f0ff0f00f0full) | ((x & 0x0000f0f00000f0f0ull) << 12) | ((x & 0x0f0f00000f0f0000ull) >> 12);
+		return (a & 0xff00ff0000ff00ffull) | ((a & 0x00ff00ff00000000ull) >> 24) | ((a & 0x00000000ff00ff00ull) << 24);
+	}
+
+	/**
+	 * slide all the rows with a row table, or all the columns with a column table
+	 * return the total reward, or -1 if nothing is moved
+	 */
+	reward slide_rows(const uint16_t* next, const reward* gain) {
+		bits prev = tile;
+		reward score = 0;
+		tile = 0;
+		for (unsigned r = 0; r < 4; r++) {
+			unsigned v = (prev >> (16 * r)) & 0xffff;
+			tile |= bits(next[v]) << (16 * r);
+			score += gain[v];
+		}
+		return tile != prev ? score : -1;
+	}
+	reward slide_cols(const bits* next, const reward* gain) {
+		bits prev = tile, cols = transpose(tile);
+		reward score = 0;
+		tile = 0;
+		for (unsigned c = 0; c < 4; c++) {
+			unsigned v = (cols >> (16 * c)) & 0xffff;
+			tile |= next[v] << (4 * c);
+			score += gain[v];
 		}
+		return tile != prev ? score : -1;
 	}
 
+	/**
+	 * precomputed sliding results and rewards of all the 65536 possible rows
+	 *
+	 * a row (or a column) is indexed by its 4 tiles as a 16-bit integer, where the
+	 * first tile (leftmost or topmost) is the lowest nibble
+	 * left and right store the resulting row, and up and down store the same results
+	 * of left and right spread as the first column of a packed board
+	 */
+	struct lookup {
+		uint16_t left[65536];
+		uint16_t right[65536];
+		bits up[65536];
+		bits down[65536];
+		reward score_left[65536];
+		reward score_right[65536];
+		uint8_t movable[65536]; // bit 0 if the row moves by left, bit 1 if it moves by right
+
+		lookup() {
+			for (unsigned v = 0; v < 65536; v++) {
+				cell row[4] = { v & 0x0f, (v >> 4) & 0x0f, (v >> 8) & 0x0f, (v >> 12) & 0x0f };
+				reward score = 0;
+				for (int c = 1; c < 4; c++) {
+					cell& t0 = row[c - 1];
+					cell& t1 = row[c];
+					if (t0 == 0) {
+						t0 = t1;
+						t1 = 0;
+					} else if (t1 != 0 && ((t0 + t1 == 3) || (t0 == t1 && t0 >= 3 && t0 < 14))) {
+						t0 = std::max(t0, t1) + 1;
+						t1 = 0;
+						score += itov(t0) - itov(t0 - 1) * 2;
+					}
+				}
+				left[v] = row[0] | (row[1] << 4) | (row[2] << 8) | (row[3] << 12);
+				score_left[v] = score;
+			}
+			for (unsigned v = 0; v < 65536; v++) {
+				right[v] = reverse(left[reverse(v)]);
+				score_right[v] = score_left[reverse(v)];
+				up[v] = spread(left[v]);
+				down[v] = spread(right[v]);
+				movable[v] = (left[v] != v ? 1 : 0) | (right[v] != v ? 2 : 0);
+			}
+		}
+
+		static unsigned reverse(unsigned v) {
+			return ((v & 0x000f) << 12) | ((v & 0x00f0) << 4) | ((v & 0x0f00) >> 4) | ((v & 0xf000) >> 12);
+		}
+		static bits spread(unsigned v) {
+			return bits(v & 0x000f) | (bits(v & 0x00f0) << 12) | (bits(v & 0x0f00) << 24) | (bits(v & 0xf000) << 36);
+		}
+
+		static const lookup& find() {
+			static const lookup lut;
+			return lut;
+		}
+	};
+
 public:
 	friend std::ostream& operator <<(std::ostream& out, const board& b) {
 		out << "+------------------------+" << std::endl;
 		for (int i = 0; i < 4; i++) {
-			auto& row = b[i];
+			auto row = b[i];
 			out << "|" << std::dec;
 			for (auto t : row) out << std::setw(6) << itot(t);
 			out << "|";
@@ -283,13 +412,33 @@ public:
 	friend std::istream& operator >>(std::istream& in, board& b) {
 		for (int i = 0; i < 16; i++) {
 			while (!std::isdigit(in.peek()) && in.good()) in.ignore(1);
-			in >> b(i);
-			b(i) = ttoi(b(i));
+			cell t = 0;
+			in >> t;
+			b(i) = ttoi(t);
 		}
 		return in;
 	}
 
 private:
-	grid tile;
+	bits tile; // (tile-15:4-bit) ... (tile-1:4-bit) (tile-0:4-bit)
 	data attr; // (#3-tile:4-bit) (#2-tile:4-bit) (#1-tile:4-bit) (last_action:4-bit) (hint_tile:4-bit)
 };
+
+/**
+ * the afterstate of a sliding action
+ * the reward is -1 if the action is illegal, in which case the state is left untouched
+ */
+struct board::afterstate {
+	board state;
+	reward gain;
+	bool legal() const { return gain != -1; }
+};
+
+inline board::afterstate board::after(unsigned opcode) const {
+	board b(*this);
+	reward r = b.slide(opcode);
+	return { b, r };
+}
+inline board::afterstates board::after() const {
+	return {{ after(0), after(1), after(2), after(3) }};
+}
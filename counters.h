@@ -0,0 +1,130 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * counters.h: Counters of the hot paths for tuning
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#if defined(THREES_COUNTERS) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+/**
+ * counters of the hot paths, i.e., the slides attempted and the legal ones, the evaluated afterstates,
+ * the TD updates and the sum of their magnitudes, and the cache misses of the threads, e.g.,
+ * shown by the statistics of each block
+ *
+ * they are compiled in only with -DTHREES_COUNTERS (make COUNTERS=1), otherwise the calls are empty;
+ * each thread adds to its own counters, which are summed by total(), and the cache misses are read
+ * from the perf events of the threads if supported (see perf_event_open), otherwise they are 0
+ */
+class counters {
+public:
+	struct values {
+		uint64_t slides = 0, legal = 0, evals = 0, updates = 0, misses = 0;
+		double delta = 0; // the sum of |alpha * error| of the updates
+
+		values& operator +=(const values& v) {
+			slides += v.slides, legal += v.legal, evals += v.evals, updates += v.updates, misses += v.misses;
+			delta += v.delta;
+			return *this;
+		}
+		values operator -(const values& v) const {
+			values d = *this;
+			d.slides -= v.slides, d.legal -= v.legal, d.evals -= v.evals, d.updates -= v.updates, d.misses -= v.misses;
+			d.delta -= v.delta;
+			return d;
+		}
+	};
+
+#if defined(THREES_COUNTERS)
+	static constexpr bool enabled = true;
+	static void slide(bool legal) { add(self().slides, 1); add(self().legal, legal ? 1 : 0); }
+	static void eval(uint64_t num) { add(self().evals, num); }
+	static void update(double delta) { add(self().updates, 1); add(self().delta, delta); }
+
+	/**
+	 * the sums of the counters of all the threads, including the exited ones
+	 */
+	static values total() {
+		self(); // the calling thread is counted from the first call
+		std::lock_guard<std::mutex> guard(lock());
+		values sum = retired();
+		for (local* c : live()) sum += c->read();
+		return sum;
+	}
+#else
+	static constexpr bool enabled = false;
+	static void slide(bool legal) {}
+	static void eval(uint64_t num) {}
+	static void update(double delta) {}
+	static values total() { return {}; }
+#endif
+
+private:
+#if defined(THREES_COUNTERS)
+	template<typename type, typename value>
+	static void add(std::atomic<type>& c, value v) { c.store(c.load(std::memory_order_relaxed) + type(v), std::memory_order_relaxed); }
+
+	/**
+	 * the counters of a thread, which are written only by the thread, and are read by any
+	 */
+	struct local {
+		std::atomic<uint64_t> slides{0}, legal{0}, evals{0}, updates{0};
+		std::atomic<double> delta{0};
+		int perf = -1;
+
+		local() {
+#if defined(__linux__)
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			perf = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0)); // this thread on any CPU
+#endif
+			std::lock_guard<std::mutex> guard(lock());
+			live().push_back(this);
+		}
+		~local() {
+			std::lock_guard<std::mutex> guard(lock());
+			retired() += read();
+			live().erase(std::find(live().begin(), live().end(), this));
+#if defined(__linux__)
+			if (perf >= 0) close(perf);
+#endif
+		}
+		values read() const {
+			values v;
+			v.slides = slides.load(std::memory_order_relaxed);
+			v.legal = legal.load(std::memory_order_relaxed);
+			v.evals = evals.load(std::memory_order_relaxed);
+			v.updates = updates.load(std::memory_order_relaxed);
+			v.delta = delta.load(std::memory_order_relaxed);
+#if defined(__linux__)
+			uint64_t misses = 0;
+			if (perf >= 0 && ::read(perf, &misses, sizeof(misses)) == sizeof(misses)) v.misses = misses;
+#endif
+			return v;
+		}
+	};
+
+	static local& self() { static thread_local local c; return c; }
+	static std::mutex& lock() { static std::mutex m; return m; }
+	static std::vector<local*>& live() { static std::vector<local*> v; return v; }
+	static values& retired() { static values v; return v; }
+#endif
+};
@@ -15,13 +15,41 @@
 #include <sstream>
 #include <chrono>
 #include <numeric>
+#include <string>
+#include <cstring>
+#include <cstdint>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 
 class episode {
 public:
-	episode() : ep_state(initial_state()), ep_score(0), ep_time(0) { ep_moves.reserve(10000); }
+	episode(size_t capacity = 0) : ep_state(initial_state()), ep_score(0), ep_time(0) { reserve(capacity); }
+
+public:
+	/**
+	 * restart the episode, where the move buffer is kept for reuse
+	 */
+	void clear() {
+		ep_state = initial_state();
+		ep_score = 0;
+		ep_moves.clear();
+		ep_time = 0;
+		ep_open = {};
+		ep_close = {};
+	}
+
+	/**
+	 * the number of moves the buffer can hold without reallocation
+	 */
+	size_t capacity() const { return ep_moves.capacity(); }
+	void reserve(size_t capacity) { ep_moves.reserve(capacity); }
+
+	/**
+	 * whether the moves are timed, which can be turned off for maximum throughput
+	 */
+	static bool timing() { return timer(); }
+	static void timing(bool on) { timer() = on; }
 
 public:
 	board& state() { return ep_state; }
@@ -35,14 +63,24 @@ public:
 		ep_close = { tag, millisec() };
 	}
 	bool apply_action(action move) {
-		board::reward reward = move.apply(state());
+		board::reward reward = apply(move, state());
 		if (reward == -1) return false;
-		ep_moves.emplace_back(move, reward, millisec() - ep_time);
+		ep_moves.emplace_back(move, reward, timing() ? nanosec() - ep_time : 0);
 		ep_score += reward;
 		return true;
 	}
+	/**
+	 * apply an action by its type, which avoids looking up its prototype for the known types
+	 */
+	static board::reward apply(const action& move, board& b) {
+		switch (move.type()) {
+		case action::slide::type: return action::slide(move).slide::apply(b);
+		case action::place::type: return action::place(move).place::apply(b);
+		default:                  return move.apply(b);
+		}
+	}
 	agent& take_turns(agent& slide, agent& place) {
-		ep_time = millisec();
+		ep_time = timing() ? nanosec() : 0;
 		return step() >= 9 && (step() - 8) % 2 ? slide : place;
 	}
 	agent& last_turns(agent& slide, agent& place) {
@@ -59,6 +97,9 @@ public:
 		}
 	}
 
+	/**
+	 * the time of the moves of an agent in nanoseconds, or the duration of the episode by default
+	 */
 	time_t time(unsigned who = -1u) const {
 		time_t time = 0;
 		size_t i = 9;
@@ -71,12 +112,22 @@ public:
 			while (i < ep_moves.size()) time += ep_moves[i].time, i += 2;
 			break;
 		default:
-			time = ep_close.when - ep_open.when;
+			time = (ep_close.when - ep_open.when) * 1000000;
 			break;
 		}
 		return time;
 	}
 
+	/**
+	 * visit the time of each move of an agent in nanoseconds
+	 */
+	template<typename visitor>
+	void times(unsigned who, visitor&& visit) const {
+		size_t i = who == action::place::type ? 0 : 9;
+		for (; i < 8 && i < ep_moves.size(); i++) visit(ep_moves[i].time);
+		for (; i < ep_moves.size(); i += 2) visit(ep_moves[i].time);
+	}
+
 	std::vector<action> actions(unsigned who = -1u) const {
 		std::vector<action> res;
 		size_t i = 9;
@@ -119,8 +170,137 @@ public:
 		return in;
 	}
 
+	/**
+	 * append the binary record of the episode, i.e., its open tag, its moves, its close tag,
+	 * and its final state and score as a checkpoint
+	 *
+	 * a move is its 16-bit code (see pack) followed by its reward and its time (in nanoseconds) as varints
+	 * if they are not zero, and the close time is stored as a delta from the open time
+	 */
+	void encode(std::string& buf) const {
+		put_string(buf, ep_open.tag);
+		put_varint(buf, zigzag(ep_open.when));
+		put_varint(buf, ep_moves.size());
+		for (const move& mv : ep_moves) {
+			uint16_t code = pack(mv.code) | (mv.reward ? 0x4000 : 0) | (mv.time ? 0x2000 : 0);
+			buf.append(reinterpret_cast<const char*>(&code), sizeof(code));
+			if (mv.reward) put_varint(buf, zigzag(mv.reward));
+			if (mv.time) put_varint(buf, zigzag(mv.time));
+		}
+		put_string(buf, ep_close.tag);
+		put_varint(buf, zigzag(ep_close.when - ep_open.when));
+		put_varint(buf, ep_state.raw());
+		put_varint(buf, ep_state.info());
+		put_varint(buf, ep_score);
+	}
+	/**
+	 * read a binary record written by encode, return whether it is well-formed
+	 * the final state is restored from the checkpoint, or by replaying the moves if replay is set
+	 * the times of the moves are scaled by unit, e.g., 1000000 for records in milliseconds
+	 */
+	bool decode(const char*& it, const char* end, bool replay = false, time_t unit = 1) {
+		*this = {};
+		uint64_t size = 0, when = 0, raw = 0, info = 0, score = 0;
+		if (!get_string(it, end, ep_open.tag) || !get_varint(it, end, when)) return false;
+		ep_open.when = unzigzag(when);
+		if (!get_varint(it, end, size)) return false;
+		if (size > uint64_t(end - it)) return false;
+		std::vector<move>(size).swap(ep_moves); // exactly sized, instead of the reserved capacity
+		for (move& mv : ep_moves) {
+			uint16_t code;
+			uint64_t reward = 0, time = 0;
+			if (end - it < ptrdiff_t(sizeof(code))) return false;
+			std::memcpy(&code, it, sizeof(code));
+			it += sizeof(code);
+			if ((code & 0x4000) && !get_varint(it, end, reward)) return false;
+			if ((code & 0x2000) && !get_varint(it, end, time)) return false;
+			mv = move(unpack(code), unzigzag(reward), unzigzag(time) * unit);
+			if (replay) ep_score += mv.code.apply(ep_state);
+		}
+		if (!get_string(it, end, ep_close.tag) || !get_varint(it, end, when)) return false;
+		ep_close.when = ep_open.when + unzigzag(when);
+		if (!get_varint(it, end, raw) || !get_varint(it, end, info) || !get_varint(it, end, score)) return false;
+		if (!replay) ep_state = board(raw, info), ep_score = score;
+		return true;
+	}
+
+	/**
+	 * walk over a binary record without decoding it, return whether it is well-formed
+	 * moves points to its first move, and size is its number of moves
+	 */
+	static bool skip(const char*& it, const char* end, const char** moves = nullptr, uint64_t* size = nullptr) {
+		uint64_t num = 0, v = 0;
+		std::string tag;
+		if (!get_string(it, end, tag) || !get_varint(it, end, v) || !get_varint(it, end, num)) return false;
+		if (moves) *moves = it;
+		if (size) *size = num;
+		for (uint64_t i = 0; i < num; i++) {
+			action a;
+			if (!next_move(it, end, a)) return false;
+		}
+		return get_string(it, end, tag) && get_varint(it, end, v) && get_varint(it, end, v)
+			&& get_varint(it, end, v) && get_varint(it, end, v);
+	}
+	/**
+	 * read the next move of a binary record, whose reward and time are skipped
+	 */
+	static bool next_move(const char*& it, const char* end, action& a) {
+		uint16_t code;
+		uint64_t v;
+		if (end - it < ptrdiff_t(sizeof(code))) return false;
+		std::memcpy(&code, it, sizeof(code));
+		it += sizeof(code);
+		if ((code & 0x4000) && !get_varint(it, end, v)) return false;
+		if ((code & 0x2000) && !get_varint(it, end, v)) return false;
+		a = unpack(code);
+		return true;
+	}
+
 protected:
 
+	/**
+	 * the 16-bit code of an action, i.e., (slide:1-bit) (reserved:3-bit) (event:12-bit),
+	 * where encode uses the reserved bits to flag whether the reward and the time follow
+	 */
+	static uint16_t pack(const action& a) {
+		return (a.type() == action::slide::type ? 0x8000 : 0) | (a.event() & 0x0fff);
+	}
+	static action unpack(uint16_t code) {
+		if (code & 0x8000) return action::slide(code & 0b11);
+		return action::place(code & 0x0f, (code >> 4) & 0x0f, (code >> 8) & 0x0f);
+	}
+
+	static uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+	static int64_t unzigzag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+	static void put_varint(std::string& buf, uint64_t v) {
+		for (; v >= 0x80; v >>= 7) buf.push_back(char(v | 0x80));
+		buf.push_back(char(v));
+	}
+	static bool get_varint(const char*& it, const char* end, uint64_t& v) {
+		v = 0;
+		for (unsigned shift = 0; it != end && shift < 64; shift += 7) {
+			uint8_t byte = *(it++);
+			v |= uint64_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false;
+	}
+	static void put_string(std::string& buf, const std::string& str) {
+		put_varint(buf, str.size());
+		buf.append(str);
+	}
+	static bool get_string(const char*& it, const char* end, std::string& str) {
+		uint64_t size;
+		if (!get_varint(it, end, size) || uint64_t(end - it) < size) return false;
+		str.assign(it, size);
+		it += size;
+		return true;
+	}
+
+	/**
+	 * a move with its reward and its time in nanoseconds,
+	 * where the text format has the time in milliseconds, and omits the time less than 1 millisecond
+	 */
 	struct move {
 		action code;
 		board::reward reward;
@@ -131,7 +311,7 @@ protected:
 		friend std::ostream& operator <<(std::ostream& out, const move& m) {
 			out << m.code;
 			if (m.reward) out << '[' << std::dec << m.reward << ']';
-			if (m.time) out << '(' << std::dec << m.time << ')';
+			if (m.time >= 1000000) out << '(' << std::dec << (m.time / 1000000) << ')';
 			return out;
 		}
 		friend std::istream& operator >>(std::istream& in, move& m) {
@@ -146,6 +326,7 @@ protected:
 			if (in.peek() == '(') {
 				in.ignore(1);
 				in >> std::dec >> m.time;
+				m.time *= 1000000;
 				in.ignore(1);
 			}
 			return in;
@@ -168,6 +349,11 @@ protected:
 	static board initial_state() {
 		return {};
 	}
+	static bool& timer() { static bool on = true; return on; }
+	static time_t nanosec() {
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+	}
 	static time_t millisec() {
 		auto now = std::chrono::system_clock::now().time_since_epoch();
 		return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
@@ -0,0 +1,300 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * pattern.h: N-tuple pattern for indexing the weight tables
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <array>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include "board.h"
+
+/**
+ * n-tuple pattern with 4 to 6 cells, and optionally its 8 isomorphisms
+ *
+ * the index of a pattern is its tiles concatenated as 4-bit digits,
+ * with the first cell as the most significant digit, e.g.,
+ * pattern { 0, 1, 2, 3 } of a board with the first row (a, b, c, d) is 0xabcd
+ *
+ * the k-th isomorphism evaluates the pattern on the k-th symmetric board (see symmetric),
+ * and all the isomorphisms of a pattern share the same weight table
+ *
+ * the indexing is compiled when the pattern is built: the cells are grouped into runs of
+ * consecutive positions, each of which is a single shift and mask, and the transposed
+ * board is read instead if the cells are consecutive that way (e.g., the columns)
+ * since the first cell is the most significant, the runs are read from the board rotated by 180 degrees,
+ * where the cells are reversed, i.e., cell p is at 15 - p
+ */
+class pattern {
+public:
+	static constexpr unsigned min_length = 4, max_length = 6;
+
+	pattern(const std::vector<unsigned>& cells, unsigned iso = 1) : cell(cells), iso(iso) {
+		std::vector<unsigned> rev(cells.rbegin(), cells.rend()), trans;
+		for (unsigned& p : rev) p = 15 - p;
+		for (unsigned p : rev) trans.push_back((p % 4) * 4 + (p / 4));
+		for (unsigned k = 0; k < iso; k++) {
+			bool use = runs(trans) < runs(rev);
+			compile(k, use ? transpose(reverse(k)) : reverse(k), use ? trans : rev);
+		}
+	}
+
+	/**
+	 * the cells, the number of isomorphisms, and the size of the weight table
+	 */
+	const std::vector<unsigned>& cells() const { return cell; }
+	unsigned isomorphism() const { return iso; }
+	size_t table_size() const { return size_t(1) << (4 * cell.size()); }
+
+	bool operator ==(const pattern& p) const { return cell == p.cell && iso == p.iso; }
+	bool operator !=(const pattern& p) const { return !(*this == p); }
+
+	/**
+	 * a run of cells of an isomorphism, i.e.,
+	 * the bits taken from the symmetric board, and where they go in the index
+	 */
+	struct segment {
+		uint8_t sym;
+		uint8_t from, to;
+		uint32_t mask;
+	};
+	const std::vector<segment>& segments(unsigned k) const { return code[k]; }
+
+	/**
+	 * the index of the k-th isomorphism on a board
+	 */
+	uint32_t index(const board& b, unsigned k = 0) const {
+		uint32_t idx = 0;
+		for (const segment& s : code[k]) idx |= uint32_t((symmetric(b, s.sym) >> s.from) & s.mask) << s.to;
+		return idx;
+	}
+
+	/**
+	 * the k-th symmetric board, i.e., reflected horizontally if k >= 4, then rotated clockwise k times
+	 */
+	static board::bits symmetric(board b, unsigned k) {
+		if (k >= 4) b.reflect_horizontal();
+		b.rotate(k);
+		return b.raw();
+	}
+
+	/**
+	 * all the 8 symmetric boards, derived from the board and its transpose with at most 2 reflections
+	 */
+	static void symmetric(const board& b, board::bits* sym) {
+		board x(b.raw(), 0), t(b.raw(), 0);
+		t.transpose();
+		sym[0] = x.raw();
+		sym[7] = t.raw();
+		x.reflect_horizontal(), t.reflect_horizontal();
+		sym[4] = x.raw();
+		sym[1] = t.raw();
+		x.reflect_vertical(), t.reflect_vertical();
+		sym[2] = x.raw();
+		sym[5] = t.raw();
+		x.reflect_horizontal(), t.reflect_horizontal();
+		sym[6] = x.raw();
+		sym[3] = t.raw();
+	}
+
+	/**
+	 * parse patterns from a description such as "0,1,2,3,4,5;4,5,6,7,8,9"
+	 * return an empty list if any of the patterns is malformed, e.g., has other characters or repeated cells
+	 */
+	static std::vector<pattern> parse(const std::string& info, unsigned iso = 1) {
+		std::vector<pattern> patt;
+		std::stringstream in(info);
+		for (std::string token; std::getline(in, token, ';'); ) {
+			std::replace(token.begin(), token.end(), ',', ' ');
+			std::vector<unsigned> cells;
+			std::stringstream tuple(token);
+			for (unsigned pos; tuple >> pos; cells.push_back(pos)) {
+				if (pos >= 16 || std::find(cells.begin(), cells.end(), pos) != cells.end()) return {};
+			}
+			if (!tuple.eof()) return {}; // stopped before the end, e.g., by "x" of "0,1,x,3"
+			if (cells.size() < min_length || cells.size() > max_length) return {};
+			patt.emplace_back(cells, iso);
+		}
+		return patt;
+	}
+
+private:
+	static unsigned runs(const std::vector<unsigned>& cells) {
+		unsigned num = 1;
+		for (size_t j = 1; j < cells.size(); j++) num += (cells[j] != cells[j - 1] + 1);
+		return num;
+	}
+
+	/**
+	 * the symmetric board which is the transpose, or the 180-degree rotation, of the k-th symmetric board
+	 */
+	static unsigned transpose(unsigned k) {
+		board trans(symmetric(board(0xfedcba9876543210ull, 0), k), 0);
+		trans.transpose();
+		return symmetry_of(trans, k);
+	}
+	static unsigned reverse(unsigned k) {
+		board rev(symmetric(board(0xfedcba9876543210ull, 0), k), 0);
+		rev.reverse();
+		return symmetry_of(rev, k);
+	}
+	static unsigned symmetry_of(const board& b, unsigned k) {
+		board idx(0xfedcba9876543210ull, 0);
+		for (unsigned j = 0; j < 8; j++)
+			if (symmetric(idx, j) == b.raw()) return j;
+		return k;
+	}
+
+	void compile(unsigned k, unsigned sym, const std::vector<unsigned>& cells) {
+		std::vector<segment>& seg = code[k];
+		for (size_t j = 0; j < cells.size(); j++) {
+			if (j == 0 || cells[j] != cells[j - 1] + 1) {
+				seg.push_back({ uint8_t(sym), uint8_t(4 * cells[j]), uint8_t(4 * j), 0 });
+			}
+			seg.back().mask = (seg.back().mask << 4) | 0x0f;
+		}
+	}
+
+	std::vector<unsigned> cell;
+	unsigned iso;
+	std::array<std::vector<segment>, 8> code;
+};
+
+/**
+ * compile-time pattern, whose index is unrolled with constant shifts
+ */
+template<unsigned... cells> struct fixed_tuple;
+template<unsigned c>
+struct fixed_tuple<c> {
+	static std::vector<unsigned> cells() { return { c }; }
+	static uint32_t index(board::bits raw) { return (raw >> (4 * c)) & 0x0f; }
+};
+template<unsigned c, unsigned... rest>
+struct fixed_tuple<c, rest...> {
+	static std::vector<unsigned> cells() { return { c, rest... }; }
+	static uint32_t index(board::bits raw) { return (((raw >> (4 * c)) & 0x0f) << (4 * sizeof...(rest))) | fixed_tuple<rest...>::index(raw); }
+};
+
+/**
+ * compile-time network of fixed_tuple patterns, each with 1 or 8 isomorphisms
+ * the features are ordered by pattern, then by isomorphism
+ */
+template<unsigned iso, typename... tuples>
+struct fixed_network {
+	static std::vector<pattern> patterns() {
+		return { pattern(tuples::cells(), iso)... };
+	}
+	static void index(const board& b, uint32_t* index) {
+		board::bits sym[8] = { b.raw() };
+		if (iso == 8) pattern::symmetric(b, sym);
+		int expand[] = { (fill<tuples>(sym, index), 0)... };
+		(void) expand;
+	}
+
+private:
+	template<typename tuple>
+	static void fill(const board::bits* sym, uint32_t*& index) {
+		for (unsigned k = 0; k < iso; k++) *(index++) = tuple::index(sym[k]);
+	}
+};
+
+/**
+ * the feature extraction of a network, which writes the indices of all the patterns and their
+ * isomorphisms, ordered by pattern, then by isomorphism
+ *
+ * networks matching a built-in fixed_network are indexed by its compile-time specialization,
+ * otherwise the segments of all the patterns are flattened into one list, so that indexing a board
+ * is a single loop of shifts and masks over the needed symmetric boards
+ */
+class indexer {
+public:
+	/**
+	 * the 4 rows and the 4 columns without isomorphisms (default)
+	 */
+	typedef fixed_network<1,
+		fixed_tuple<0, 1, 2, 3>, fixed_tuple<4, 5, 6, 7>, fixed_tuple<8, 9, 10, 11>, fixed_tuple<12, 13, 14, 15>,
+		fixed_tuple<0, 4, 8, 12>, fixed_tuple<1, 5, 9, 13>, fixed_tuple<2, 6, 10, 14>, fixed_tuple<3, 7, 11, 15>> rows_and_columns;
+	/**
+	 * the 4 6-tuples with 8 isomorphisms, i.e., "0,1,2,3,4,5;4,5,6,7,8,9;0,1,2,4,5,6;4,5,6,8,9,10"
+	 */
+	typedef fixed_network<8,
+		fixed_tuple<0, 1, 2, 3, 4, 5>, fixed_tuple<4, 5, 6, 7, 8, 9>,
+		fixed_tuple<0, 1, 2, 4, 5, 6>, fixed_tuple<4, 5, 6, 8, 9, 10>> six_tuples;
+
+public:
+	indexer(const std::vector<pattern>& patt = {}) : fixed(nullptr), num(0), trans(false) {
+		if (patt == rows_and_columns::patterns()) fixed = &rows_and_columns::index;
+		if (patt == six_tuples::patterns()) fixed = &six_tuples::index;
+
+		unsigned syms = 0;
+		for (const pattern& p : patt) {
+			for (unsigned k = 0; k < p.isomorphism(); k++, num++) {
+				for (pattern::segment s : p.segments(k)) {
+					code.push_back({ s.sym, s.from, s.to, s.mask, uint32_t(num) });
+					syms |= 1u << s.sym;
+				}
+			}
+		}
+		// each symmetric board is the board or its transpose, reflected horizontally and/or vertically
+		board idx(0xfedcba9876543210ull, 0);
+		for (unsigned k = 0; k < 8; k++) {
+			if (!(syms & (1u << k))) continue;
+			for (unsigned op = 0; op < 8; op++) {
+				board b = idx;
+				if (op & 4) b.transpose();
+				if (op & 2) b.reflect_horizontal();
+				if (op & 1) b.reflect_vertical();
+				if (b.raw() != pattern::symmetric(idx, k)) continue;
+				sym.push_back({ uint8_t(k), uint8_t(op) });
+				trans |= (op & 4);
+				break;
+			}
+		}
+	}
+
+	/**
+	 * the number of features
+	 */
+	size_t size() const { return num; }
+
+	/**
+	 * write the indices of all the features of a board
+	 */
+	void operator ()(const board& b, uint32_t* index) const {
+		if (fixed) return fixed(b, index);
+		board base(b.raw(), 0), transposed(b.raw(), 0);
+		if (trans) transposed.transpose();
+		board::bits raw[8];
+		for (const symmetry& s : sym) {
+			board x = (s.op & 4) ? transposed : base;
+			if (s.op & 2) x.reflect_horizontal();
+			if (s.op & 1) x.reflect_vertical();
+			raw[s.k] = x.raw();
+		}
+		std::fill(index, index + num, 0);
+		for (const step& s : code) index[s.feature] |= uint32_t((raw[s.sym] >> s.from) & s.mask) << s.to;
+	}
+
+private:
+	struct step {
+		uint8_t sym;
+		uint8_t from, to;
+		uint32_t mask;
+		uint32_t feature;
+	};
+	struct symmetry {
+		uint8_t k;
+		uint8_t op; // (transpose:1-bit) (reflect_horizontal:1-bit) (reflect_vertical:1-bit)
+	};
+	void (*fixed)(const board& b, uint32_t* index);
+	std::vector<step> code;
+	std::vector<symmetry> sym;
+	size_t num;
+	bool trans;
+};
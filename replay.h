@@ -0,0 +1,191 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * replay.h: Random access to the episodes of a binary log
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <atomic>
+#include <fstream>
+#include <cstdint>
+#include "board.h"
+#include "action.h"
+#include "episode.h"
+#include "statistics.h"
+#if defined(__unix__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+ * reader of a binary log (see statistics::save_binary), which seeks to any episode or any ply of it
+ * without parsing the episodes before it, e.g., for building datasets from the logs
+ *
+ * the log is memory-mapped (or read if mapping is not supported), and open() indexes the offset of
+ * each episode, where the blocks are indexed by the given number of threads
+ * the board after every period moves of an episode is kept as a checkpoint when the episode is first
+ * replayed, so a board is replayed from its nearest checkpoint, i.e., by less than period moves
+ *
+ * at() and state() can be called by any threads at once, where the checkpoints of an episode are published
+ * by an atomic pointer, so the threads replaying an episode at once may build them twice, but keep one
+ */
+class log_reader {
+public:
+	log_reader(size_t period = 64) : period(std::max<size_t>(period, 1)) {}
+	~log_reader() { release(); }
+
+	/**
+	 * open and index a log, return whether it is a well-formed binary log
+	 */
+	bool open(const std::string& path, unsigned threads = 1) {
+		release();
+		offsets.clear();
+		if (!map(path)) return false;
+		std::vector<statistics::binary_block> blocks;
+		if (!statistics::split_binary(begin, end, blocks, unit)) return false;
+
+		std::vector<size_t> first(blocks.size() + 1, 0);
+		for (size_t b = 0; b < blocks.size(); b++) first[b + 1] = first[b] + blocks[b].episodes;
+		offsets.resize(first.back());
+		std::atomic<bool> valid(true);
+		statistics::parallel(blocks.size(), threads, [&](size_t b) {
+			const char* it = blocks[b].begin;
+			for (size_t i = first[b]; i < first[b + 1] && valid; i++) {
+				offsets[i] = it - begin;
+				valid = valid && episode::skip(it, blocks[b].end);
+			}
+			valid = valid && it == blocks[b].end;
+		});
+		marks.reset(new std::atomic<const track*>[offsets.size()]);
+		for (size_t i = 0; i < offsets.size(); i++) marks[i] = nullptr;
+		return valid;
+	}
+
+	/**
+	 * the number of episodes
+	 */
+	size_t size() const { return offsets.size(); }
+
+	/**
+	 * the k-th episode, decoded from its record
+	 */
+	episode at(size_t k) const {
+		episode ep;
+		const char* it = begin + offsets.at(k);
+		ep.decode(it, end, false, unit);
+		return ep;
+	}
+
+	/**
+	 * the number of moves of the k-th episode
+	 */
+	size_t moves(size_t k) const { return checkpoints(k).moves; }
+
+	/**
+	 * the board of the k-th episode after its first ply moves (or all of them if ply is beyond)
+	 */
+	board state(size_t k, size_t ply) const {
+		const track& line = checkpoints(k);
+		ply = std::min<size_t>(ply, line.moves);
+		const mark& from = line.marks[ply / period];
+		board b = from.state;
+		const char* it = begin + from.offset;
+		for (size_t i = ply / period * period; i < ply; i++) {
+			action a;
+			episode::next_move(it, end, a);
+			episode::apply(a, b);
+		}
+		return b;
+	}
+
+private:
+	/**
+	 * a checkpoint, i.e., the board before a move and the offset of the move
+	 */
+	struct mark {
+		board state;
+		size_t offset;
+	};
+	struct track {
+		size_t moves = 0;
+		std::vector<mark> marks;
+	};
+
+	/**
+	 * the checkpoints of the k-th episode, which are built when it is first replayed
+	 */
+	const track& checkpoints(size_t k) const {
+		if (k >= offsets.size()) throw std::out_of_range("log_reader::checkpoints");
+		if (const track* built = marks[k].load(std::memory_order_acquire)) return *built;
+		std::unique_ptr<track> line(new track());
+		const char* it = begin + offsets[k], * moves;
+		uint64_t size = 0;
+		episode::skip(it, end, &moves, &size);
+		board b;
+		it = moves;
+		for (uint64_t i = 0; i < size; i++) {
+			if (i % period == 0) line->marks.push_back({ b, size_t(it - begin) });
+			action a;
+			episode::next_move(it, end, a);
+			episode::apply(a, b);
+		}
+		if (size % period == 0) line->marks.push_back({ b, size_t(it - begin) });
+		line->moves = size;
+		const track* built = nullptr;
+		if (marks[k].compare_exchange_strong(built, line.get(), std::memory_order_acq_rel)) return *line.release();
+		return *built; // built by another thread meanwhile
+	}
+
+	void release() {
+		for (size_t i = 0; marks && i < offsets.size(); i++) delete marks[i].load();
+		marks.reset();
+	}
+
+	/**
+	 * map the log read-only, or read it into memory
+	 */
+	bool map(const std::string& path) {
+		mem.reset();
+		buf.clear();
+		begin = end = nullptr;
+#if defined(__unix__)
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		size_t size = ::fstat(fd, &st) == 0 ? size_t(st.st_size) : 0;
+		void* ptr = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		::close(fd);
+		if (ptr != MAP_FAILED) {
+			mem = std::shared_ptr<void>(ptr, [size](void* p) { munmap(p, size); });
+			begin = static_cast<const char*>(ptr);
+			end = begin + size;
+			return true;
+		}
+#endif
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		if (!in.is_open()) return false;
+		buf.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		begin = buf.data();
+		end = begin + buf.size();
+		return true;
+	}
+
+private:
+	size_t period;
+	std::shared_ptr<void> mem; // the mapping of the log, or buf if it is read
+	std::string buf;
+	const char* begin = nullptr;
+	const char* end = nullptr;
+	time_t unit = 1;
+	std::vector<size_t> offsets; // the offset of each episode
+	std::unique_ptr<std::atomic<const track*>[]> marks; // the checkpoints of each replayed episode, or null
+};
@@ -0,0 +1,102 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * rng.h: Fast pseudo-random number engines for the agents
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <string>
+#include <cstdint>
+
+/**
+ * pseudo-random engine of 32-bit outputs, which meets the requirements of UniformRandomBitGenerator,
+ * e.g., for std::shuffle, where the same seed always produces the same sequence
+ *
+ * the algorithms are
+ * "xoshiro": xoshiro256**, seeded by splitmix64 (default)
+ * "pcg":     pcg32, i.e., a 64-bit LCG with the XSH-RR output
+ */
+class random_engine {
+public:
+	typedef uint32_t result_type;
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return UINT32_MAX; }
+	static constexpr uint64_t default_seed = 1;
+
+	random_engine(uint64_t s = default_seed, const std::string& algo = "xoshiro") { seed(s, algo); }
+
+	/**
+	 * reseed the engine, return whether the algorithm is known
+	 */
+	bool seed(uint64_t s, const std::string& algo) {
+		pcg = (algo == "pcg");
+		seed(s);
+		return pcg || algo == "xoshiro";
+	}
+	void seed(uint64_t s) {
+		if (pcg) {
+			state[0] = 0;
+			state[1] = (s << 1) | 1;
+			next();
+			state[0] += s;
+			next();
+		} else {
+			for (uint64_t& x : state) x = splitmix(s);
+		}
+	}
+
+	/**
+	 * the seed of an independent stream, e.g., of a game, derived from a base seed
+	 */
+	static uint64_t derive(uint64_t base, uint64_t stream) {
+		uint64_t s = base ^ (stream * 0xd1b54a32d192ed03ull);
+		return splitmix(s);
+	}
+
+	result_type operator()() {
+		return next();
+	}
+
+	/**
+	 * a uniform integer in [0, n) by a multiply-shift, whose bias is negligible for small n
+	 */
+	uint32_t uniform(uint32_t n) {
+		return uint32_t((uint64_t(next()) * n) >> 32);
+	}
+
+private:
+	uint32_t next() {
+		if (pcg) {
+			uint64_t old = state[0];
+			state[0] = old * 6364136223846793005ull + state[1];
+			uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+			uint32_t rot = uint32_t(old >> 59);
+			return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+		}
+		uint64_t result = rotl(state[1] * 5, 7) * 9;
+		uint64_t t = state[1] << 17;
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = rotl(state[3], 45);
+		return uint32_t(result >> 32);
+	}
+
+	static uint64_t rotl(uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+	static uint64_t splitmix(uint64_t& s) {
+		uint64_t z = (s += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	uint64_t state[4];
+	bool pcg;
+};
@@ -0,0 +1,104 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * runner.h: Game loop for a pair of agents
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <typeinfo>
+#include <type_traits>
+#include <cstdlib>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistics.h"
+
+/**
+ * game loop of a slider and a placer, whose types are given at compile time
+ *
+ * the calls to the agents are qualified by their types, so they are resolved statically and can
+ * be inlined, which requires the agents to be exactly of the given types (checked when constructed);
+ * game_runner<agent, agent> is the polymorphic loop for agents of any types
+ */
+template<typename slider, typename placer>
+class game_runner {
+public:
+	game_runner(slider& slide, placer& place) : slide(slide), place(place) {
+		if (!exact(slide) || !exact(place)) {
+			std::cerr << "game_runner: mismatched agent types" << std::endl;
+			std::exit(-1);
+		}
+	}
+
+	/**
+	 * play the games of the statistics until it is finished
+	 */
+	void run(statistics& stats) {
+		while (!stats.is_finished()) {
+			open();
+			stats.open_episode(slide.name() + ":" + place.name());
+			agent& win = play(stats.back());
+			stats.close_episode(win.name());
+			close(win);
+		}
+	}
+
+	/**
+	 * notify the agents that a game begins or ends
+	 */
+	void open() {
+		call<slider>(slide).open_episode("~:" + place.name());
+		call<placer>(place).open_episode(slide.name() + ":~");
+	}
+	void close(agent& win) {
+		call<slider>(slide).close_episode(win.name());
+		call<placer>(place).close_episode(win.name());
+	}
+
+	/**
+	 * play a game in an opened episode, return the winner
+	 */
+	agent& play(episode& game) {
+		while (true) {
+			bool turn = &game.take_turns(slide, place) == &slide;
+			action move = turn ? call<slider>(slide).take_action(game.state()) : call<placer>(place).take_action(game.state());
+			if (game.apply_action(move) != true) break;
+			if (turn ? call<slider>(slide).check_for_win(game.state()) : call<placer>(place).check_for_win(game.state())) {
+				last_update(slide);
+				break;
+			}
+		}
+		return game.last_turns(slide, place);
+	}
+
+private:
+	/**
+	 * the qualified calls of an agent, or the virtual calls if the type is agent
+	 */
+	template<typename type>
+	struct qualified {
+		type& who;
+		void open_episode(const std::string& flag) { if (poly) who.open_episode(flag); else who.type::open_episode(flag); }
+		void close_episode(const std::string& flag) { if (poly) who.close_episode(flag); else who.type::close_episode(flag); }
+		action take_action(const board& b) { return poly ? who.take_action(b) : who.type::take_action(b); }
+		bool check_for_win(const board& b) { return poly ? who.check_for_win(b) : who.type::check_for_win(b); }
+		static constexpr bool poly = std::is_same<type, agent>::value;
+	};
+	template<typename type>
+	static qualified<type> call(type& who) { return { who }; }
+
+	template<typename type>
+	static bool exact(type& who) { return std::is_same<type, agent>::value || typeid(who) == typeid(type); }
+
+	static void last_update(weight_agent& slide) { slide.last_update(); }
+	static void last_update(agent&) {}
+
+private:
+	slider& slide;
+	placer& place;
+};
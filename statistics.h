@@ -12,6 +12,14 @@
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <numeric>
+#include <thread>
+#include <atomic>
 #include "board.h"
 #include "action.h"
 #include "episode.h"
@@ -22,14 +30,18 @@ public:
 	 * the total episodes to run
 	 * the block size of statistics
 	 * the limit of saving records
+	 * whether to keep the records for saving, otherwise only the statistics are kept
 	 *
 	 * note that total >= limit >= block
 	 */
-	statistics(size_t total, size_t block = 0, size_t limit = 0)
+	statistics(size_t total, size_t block = 0, size_t limit = 0, bool record = true)
 		: total(total),
 		  block(block ? block : total),
 		  limit(limit ? limit : total),
-		  count(0) {}
+		  count(0),
+		  record(record) {
+		origin = mark = counters::total();
+	}
 
 public:
 	/**
@@ -37,6 +49,8 @@ public:
 	 *
 	 * the format is
 	 * 1000    avg = 282, max = 2325, ops = 1346086 (2840867|955796)
+	 *         slide   p50 = 310ns, p99 = 1.54us, p999 = 4.86us, max = 61.4us
+	 *         place   p50 = 180ns, p99 = 706ns, p999 = 2.05us, max = 20.5us
 	 *         6       100%    (0.9%)
 	 *         12      99.1%   (15%)
 	 *         24      84.1%   (45.3%)
@@ -50,18 +64,286 @@ public:
 	 * 'ops = 1346086 (2840867|955796)': the average speed is 1346086
 	 *                                   the average speed of the slider is 2840867
 	 *                                   the average speed of the placer is 955796
+	 *                                   where the speeds of the agents are shown only if the moves are timed,
+	 *                                   and the average speed only if the block lasts long enough otherwise
+	 * 'p50 = 310ns, ...': the percentiles and the maximum of the latency of the moves of the slider,
+	 *                     which are shown only if the moves are timed (see episode::timing)
 	 * '84.1%': 84.1% of the games reached 24-tiles, i.e., win rate of 24-tile
 	 * '45.3%': 45.3% of the games terminated with 24-tiles as the largest tile
+	 *
+	 * with the counters compiled in (see counters), the block also shows
+	 *         counters        slides = 4121034 (76.2% legal), evals = 3140721, updates = 0, misses = 1.21/eval
+	 *         time    slide = 61.3%, place = 20.1%, other = 18.6%
+	 * where 'other' is the time of the games outside the moves, i.e., the bookkeeping, shown only if the moves are timed
+	 *
+	 * the block is also written as a JSON line to the stream given by json(), e.g., for dashboards
+	 */
+	void show(bool tstat = true) const {
+		show(last, tstat, recent);
+	}
+
+	/**
+	 * show the statistics of all the games
+	 */
+	void summary() const {
+		show(all, true, counters::total() - origin);
+	}
+
+	/**
+	 * write the JSON line of each block to a stream, or nothing if it is null
+	 */
+	void json(std::ostream* out) {
+		json_out = out;
+	}
+
+	bool is_finished() const {
+		return count >= total;
+	}
+
+	void open_episode(const std::string& flag = "") {
+		count++;
+		data.push_back(acquire());
+		data.back().open_episode(flag);
+	}
+
+	void close_episode(const std::string& flag = "") {
+		data.back().close_episode(flag);
+		retire();
+	}
+
+	/**
+	 * record an episode which is already closed, e.g., played by another thread
+	 */
+	void add_episode(episode&& ep) {
+		count++;
+		data.push_back(std::move(ep));
+		retire();
+	}
+
+	/**
+	 * an empty episode, whose move buffer is recycled from a retired episode if any, and is reserved
+	 * for the longest game observed so far, e.g., for playing a game in another thread
+	 */
+	episode acquire() {
+		size_t expect = longest + longest / 8;
+		if (pool.empty()) return episode(expect);
+		episode ep(std::move(pool.back()));
+		pool.pop_back();
+		ep.clear();
+		if (ep.capacity() < expect) ep.reserve(expect);
+		return ep;
+	}
+
+	episode& at(size_t i) {
+		return data.at(i);
+	}
+	episode& front() {
+		return data.front();
+	}
+	episode& back() {
+		return data.back();
+	}
+	size_t step() const {
+		return count;
+	}
+
+	/**
+	 * binary log of the episodes, which is a header, blocks of episodes, and an index of the blocks
+	 *
+	 * the header is the magic and the version, and each block is its number of episodes and its size
+	 * in bytes, followed by the records of its episodes (see episode::encode), and the last block is empty
+	 * the index is the offset and the number of episodes of each block, followed by the trailer,
+	 * i.e., the number of blocks, the offset of the index, and the magic, for seeking to any block
+	 */
+	static constexpr uint32_t binary_magic = 0x4c726874; // "thrL"
+	static constexpr uint32_t binary_version = 2; // 1: the times are in milliseconds
+
+	static bool is_binary(std::istream& in) {
+		uint32_t magic = 0;
+		auto pos = in.tellg();
+		in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+		in.clear();
+		in.seekg(pos);
+		return magic == binary_magic;
+	}
+
+	void save_binary(std::ostream& out, size_t episodes_per_block = 1024) const {
+		uint32_t head[] = { binary_magic, binary_version };
+		out.write(reinterpret_cast<const char*>(head), sizeof(head));
+		std::vector<std::pair<uint64_t, uint32_t>> index;
+		std::string buf;
+		for (auto it = data.begin(); it != data.end(); ) {
+			buf.clear();
+			uint32_t num = 0;
+			for (; it != data.end() && num < episodes_per_block; it++, num++) it->encode(buf);
+			index.emplace_back(uint64_t(out.tellp()), num);
+			uint32_t info[] = { num, uint32_t(buf.size()) };
+			out.write(reinterpret_cast<const char*>(info), sizeof(info));
+			out.write(buf.data(), buf.size());
+		}
+		uint32_t last[] = { 0, 0 };
+		out.write(reinterpret_cast<const char*>(last), sizeof(last));
+		uint64_t offset = out.tellp();
+		for (auto& blk : index) {
+			out.write(reinterpret_cast<const char*>(&blk.first), sizeof(blk.first));
+			out.write(reinterpret_cast<const char*>(&blk.second), sizeof(blk.second));
+		}
+		uint64_t blocks = index.size();
+		out.write(reinterpret_cast<const char*>(&blocks), sizeof(blocks));
+		out.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+		out.write(reinterpret_cast<const char*>(&head[0]), sizeof(head[0]));
+	}
+
+	/**
+	 * a block of a binary log in memory, i.e., the records of its episodes
 	 */
-	void show(bool tstat = true, size_t blk = 0) const {
-		size_t num = std::min(data.size(), blk ?: block);
+	struct binary_block {
+		const char* begin;
+		const char* end;
+		uint32_t episodes;
+	};
+	/**
+	 * split a binary log in memory into its blocks, by following the block sizes until the empty one,
+	 * return whether the blocks are well-formed, where unit is the time unit of the records (see decode)
+	 */
+	static bool split_binary(const char* it, const char* end, std::vector<binary_block>& blocks, time_t& unit) {
+		uint32_t head[2] = {};
+		if (end - it < ptrdiff_t(sizeof(head))) return false;
+		std::memcpy(head, it, sizeof(head));
+		if (head[0] != binary_magic || head[1] < 1 || head[1] > binary_version) return false;
+		unit = head[1] == 1 ? 1000000 : 1;
+		it += sizeof(head);
+		for (uint32_t info[2]; ; it += info[1]) {
+			if (end - it < ptrdiff_t(sizeof(info))) return false;
+			std::memcpy(info, it, sizeof(info));
+			it += sizeof(info);
+			if (info[0] == 0) return true;
+			if (uint64_t(end - it) < info[1]) return false;
+			blocks.push_back({ it, it + info[1], info[0] });
+		}
+	}
+
+	/**
+	 * load a binary log written by save_binary, return whether it is well-formed
+	 * the blocks are read in order until the empty one, so the index is not needed,
+	 * and are decoded by the given number of threads
+	 */
+	bool load_binary(std::istream& in, unsigned threads = 1) {
+		std::string buf;
+		auto begin = in.tellg();
+		in.seekg(0, std::ios::end);
+		buf.resize(size_t(in.tellg() - begin));
+		in.seekg(begin);
+		if (!in.read(&buf[0], buf.size())) return false;
+		std::vector<binary_block> blocks;
+		time_t unit;
+		if (!split_binary(buf.data(), buf.data() + buf.size(), blocks, unit)) return false;
+
+		std::vector<std::vector<episode>> eps(blocks.size());
+		std::atomic<bool> valid(true);
+		parallel(blocks.size(), threads, [&](size_t b) {
+			const char* it = blocks[b].begin;
+			eps[b].resize(blocks[b].episodes);
+			for (episode& ep : eps[b]) valid = valid && ep.decode(it, blocks[b].end, false, unit);
+			valid = valid && it == blocks[b].end;
+		});
+		if (!valid) return false;
+		for (std::vector<episode>& blk : eps)
+			for (episode& ep : blk) data.push_back(std::move(ep));
+		total = std::max(total, data.size());
+		count = data.size();
+		recount();
+		return true;
+	}
+	/**
+	 * load a text log, one episode per line, where the lines are parsed by the given number of threads
+	 */
+	bool load_text(std::istream& in, unsigned threads = 1) {
+		std::vector<std::string> lines;
+		for (std::string line; std::getline(in, line) && line.size(); ) lines.push_back(std::move(line));
+		std::vector<episode> eps(lines.size());
+		parallel(lines.size(), threads, [&](size_t i) { std::stringstream(lines[i]) >> eps[i]; });
+		for (episode& ep : eps) data.push_back(std::move(ep));
+		total = std::max(total, data.size());
+		count = data.size();
+		recount();
+		return true;
+	}
+
+	/**
+	 * run func(i) for i in [0, n) by the given number of threads, which take the indices in turn
+	 */
+	template<typename function>
+	static void parallel(size_t n, unsigned threads, function&& func) {
+		std::atomic<size_t> next(0);
+		auto work = [&]() { for (size_t i; (i = next++) < n; ) func(i); };
+		std::vector<std::thread> pool;
+		for (unsigned t = 1; t < std::min<size_t>(threads, n); t++) pool.emplace_back(work);
+		work();
+		for (std::thread& th : pool) th.join();
+	}
+
+	friend std::ostream& operator <<(std::ostream& out, const statistics& stat) {
+		for (const episode& rec : stat.data) out << rec << std::endl;
+		return out;
+	}
+	friend std::istream& operator >>(std::istream& in, statistics& stat) {
+		stat.load_text(in);
+		return in;
+	}
+
+private:
+	/**
+	 * log-linear histogram of latencies in nanoseconds, with 8 buckets per power of two,
+	 * so a percentile is within 12.5% of the exact one
+	 */
+	struct histogram {
+		size_t bucket[512] = { 0 };
+		size_t num = 0;
+		time_t max = 0;
+
+		void add(time_t ns) {
+			uint64_t v = std::max<time_t>(ns, 0);
+			bucket[index(v)]++;
+			num++;
+			max = std::max<time_t>(max, v);
+		}
+		/**
+		 * the upper bound of the bucket of the p-th quantile, e.g., 0.99 for p99
+		 */
+		time_t quantile(double p) const {
+			size_t rank = size_t(p * (num - 1)), accu = 0;
+			for (size_t i = 0; i < 512; i++) {
+				if ((accu += bucket[i]) > rank) return std::min<time_t>(upper(i), max);
+			}
+			return max;
+		}
+
+		static size_t index(uint64_t v) {
+			if (v < 8) return v;
+			unsigned e = 63 - __builtin_clzll(v);
+			return (e - 2) * 8 + ((v >> (e - 3)) & 7);
+		}
+		static time_t upper(size_t i) {
+			if (i < 8) return i;
+			unsigned e = i / 8 + 2;
+			return time_t(((8 + i % 8 + 1) << (e - 3)) - 1);
+		}
+	};
+
+	/**
+	 * running sums of a set of episodes, updated once per episode
+	 */
+	struct tally {
+		size_t num = 0;
 		size_t stat[64] = { 0 };
 		size_t sop = 0, pop = 0, eop = 0;
 		time_t sdu = 0, pdu = 0, edu = 0;
 		board::score sum = 0, max = 0;
-		auto it = data.end();
-		for (size_t i = 0; i < num; i++) {
-			auto& ep = *(--it);
+		histogram slide, place;
+
+		void add(const episode& ep) {
+			num++;
 			sum += ep.score();
 			max = std::max(ep.score(), max);
 			stat[*std::max_element(ep.state().begin(), ep.state().end())]++;
@@ -71,82 +353,162 @@ public:
 			sdu += ep.time();
 			pdu += ep.time(action::slide::type);
 			edu += ep.time(action::place::type);
+			if (!episode::timing()) return;
+			ep.times(action::slide::type, [this](time_t t) { slide.add(t); });
+			ep.times(action::place::type, [this](time_t t) { place.add(t); });
 		}
+		/**
+		 * whether the moves are timed, otherwise only the durations of the episodes are known, in milliseconds
+		 */
+		bool timed() const { return slide.num || place.num; }
+		/**
+		 * whether the overall speed is known, i.e., the moves are timed, or the episodes last long enough
+		 * for their durations in milliseconds
+		 */
+		bool paced() const { return timed() || sdu >= 1000000000; }
+	};
 
+	void show(const tally& t, bool tstat, const counters::values& cnt) const {
+		size_t num = t.num;
 		std::ios ff(nullptr);
 		ff.copyfmt(std::cout);
 		std::cout << std::fixed << std::setprecision(0);
 		std::cout << count << "\t";
-		std::cout << "avg = " << (sum / num) << ", ";
-		std::cout << "max = " << (max) << ", ";
-		std::cout << "ops = " << (sop * 1000.0 / sdu);
-		std::cout <<     " (" << (pop * 1000.0 / pdu);
-		std::cout <<      "|" << (eop * 1000.0 / edu) << ")";
+		std::cout << "avg = " << (t.sum / num) << ", ";
+		std::cout << "max = " << (t.max);
+		if (t.paced()) std::cout << ", " "ops = " << ratio(t.sop * 1e9, t.sdu);
+		if (t.timed()) std::cout << " (" << ratio(t.pop * 1e9, t.pdu) << "|" << ratio(t.eop * 1e9, t.edu) << ")";
 		std::cout << std::endl;
 		std::cout.copyfmt(ff);
+		show(t.slide, "slide");
+		show(t.place, "place");
+		if (counters::enabled) show(t, cnt);
+		if (json_out) json(*json_out, t, cnt);
 
 		if (!tstat) return;
-		for (size_t t = 0, c = 0; c < num; c += stat[t++]) {
-			if (stat[t] == 0) continue;
-			size_t accu = std::accumulate(std::begin(stat) + t, std::end(stat), size_t(0));
-			std::cout << "\t" << board::itot(t); // type
+		for (size_t i = 0, c = 0; c < num; c += t.stat[i++]) {
+			if (t.stat[i] == 0) continue;
+			size_t accu = std::accumulate(std::begin(t.stat) + i, std::end(t.stat), size_t(0));
+			std::cout << "\t" << board::itot(i); // type
 			std::cout << "\t" << (accu * 100.0 / num) << "%"; // win rate
-			std::cout << "\t" "(" << (stat[t] * 100.0 / num) << "%" ")"; // percentage of ending
+			std::cout << "\t" "(" << (t.stat[i] * 100.0 / num) << "%" ")"; // percentage of ending
 			std::cout << std::endl;
 		}
 		std::cout << std::endl;
 	}
 
-	void summary() const {
-		show(true, data.size());
+	void show(const histogram& h, const char* who) const {
+		if (h.num == 0) return;
+		std::cout << "\t" << who;
+		std::cout << "\t" "p50 = " << duration(h.quantile(0.5));
+		std::cout << ", " "p99 = " << duration(h.quantile(0.99));
+		std::cout << ", " "p999 = " << duration(h.quantile(0.999));
+		std::cout << ", " "max = " << duration(h.max);
+		std::cout << std::endl;
 	}
 
-	bool is_finished() const {
-		return count >= total;
+	void show(const tally& t, const counters::values& cnt) const {
+		std::cout << "\t" "counters";
+		std::cout << "\t" "slides = " << cnt.slides << " (" << ratio(cnt.legal * 100.0, cnt.slides) << "% legal)";
+		std::cout << ", " "evals = " << cnt.evals;
+		std::cout << ", " "updates = " << cnt.updates << " (|delta| = " << ratio(cnt.delta, cnt.updates) << ")";
+		std::cout << ", " "misses = " << ratio(cnt.misses, cnt.evals) << "/eval";
+		std::cout << std::endl;
+		if (!t.timed() || t.sdu == 0) return;
+		std::cout << "\t" "time";
+		std::cout << "\t" "slide = " << (t.pdu * 100.0 / t.sdu) << "%";
+		std::cout << ", " "place = " << (t.edu * 100.0 / t.sdu) << "%";
+		std::cout << ", " "other = " << ((t.sdu - t.pdu - t.edu) * 100.0 / t.sdu) << "%";
+		std::cout << std::endl;
 	}
 
-	void open_episode(const std::string& flag = "") {
-		if (count++ >= limit) data.pop_front();
-		data.emplace_back();
-		data.back().open_episode(flag);
+	/**
+	 * the JSON line of a block, e.g.,
+	 * {"games":1000,"block":1000,"avg":282,"max":2325,"ops":1346086,"slide_ops":2840867,"place_ops":955796,
+	 *  "end":{"6":9,"12":150,...},"time_ns":{"slide":...,"place":...,"other":...},"counters":{"slides":...}}
+	 * where the counters are given only if they are compiled in, the speeds of the agents and the time split only
+	 * if the moves are timed, and the overall speed only if it is known (see tally::paced)
+	 */
+	void json(std::ostream& out, const tally& t, const counters::values& cnt) const {
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << std::fixed << std::setprecision(0);
+		out << "{\"games\":" << count << ",\"block\":" << t.num;
+		out << ",\"avg\":" << ratio(t.sum, t.num) << ",\"max\":" << t.max;
+		if (t.paced()) out << ",\"ops\":" << ratio(t.sop * 1e9, t.sdu);
+		if (t.timed()) out << ",\"slide_ops\":" << ratio(t.pop * 1e9, t.pdu) << ",\"place_ops\":" << ratio(t.eop * 1e9, t.edu);
+		out << ",\"end\":{";
+		for (size_t i = 0, n = 0; i < 64; i++)
+			if (t.stat[i]) out << (n++ ? "," : "") << "\"" << board::itot(i) << "\":" << t.stat[i];
+		out << "}";
+		if (t.timed()) out << ",\"time_ns\":{\"slide\":" << t.pdu << ",\"place\":" << t.edu << ",\"other\":" << (t.sdu - t.pdu - t.edu) << "}";
+		if (counters::enabled) {
+			out << ",\"counters\":{\"slides\":" << cnt.slides << ",\"legal\":" << cnt.legal << ",\"evals\":" << cnt.evals;
+			out << ",\"updates\":" << cnt.updates << ",\"misses\":" << cnt.misses;
+			out << std::setprecision(6) << ",\"delta\":" << cnt.delta << "}";
+		}
+		out << "}" << std::endl;
+		out.copyfmt(ff);
 	}
+	static double ratio(double a, double b) { return b ? a / b : 0; }
 
-	void close_episode(const std::string& flag = "") {
-		data.back().close_episode(flag);
-		if (count % block == 0) show();
+	static std::string duration(time_t ns) {
+		const char* unit[] = { "ns", "us", "ms", "s" };
+		double v = ns;
+		size_t u = 0;
+		for (; v >= 1000 && u < 3; u++) v /= 1000;
+		std::stringstream ss;
+		ss << std::setprecision(3) << v << unit[u];
+		return ss.str();
 	}
 
-	episode& at(size_t i) {
-		return data.at(i);
-	}
-	episode& front() {
-		return data.front();
-	}
-	episode& back() {
-		return data.back();
-	}
-	size_t step() const {
-		return count;
+	/**
+	 * count the last episode, show the block if it is completed, and retire the episodes beyond the limit
+	 * (or all of them if the records are not kept) to the pool
+	 */
+	void retire() {
+		last.add(data.back());
+		all.add(data.back());
+		longest = std::max(longest, data.back().step());
+		if (count % block == 0) {
+			counters::values now = counters::total();
+			recent = now - mark;
+			mark = now;
+			show();
+			last = {};
+		}
+		while (data.size() > (record ? limit : 0)) {
+			if (pool.size() < max_pool) pool.push_back(std::move(data.front()));
+			data.pop_front();
+		}
 	}
 
-	friend std::ostream& operator <<(std::ostream& out, const statistics& stat) {
-		for (const episode& rec : stat.data) out << rec << std::endl;
-		return out;
-	}
-	friend std::istream& operator >>(std::istream& in, statistics& stat) {
-		for (std::string line; std::getline(in, line) && line.size(); ) {
-			stat.data.emplace_back();
-			std::stringstream(line) >> stat.data.back();
+	/**
+	 * rebuild the running sums from the records, e.g., after loading
+	 */
+	void recount() {
+		all = {};
+		last = {};
+		size_t tail = block ? count % block : 0;
+		for (size_t i = 0; i < data.size(); i++) {
+			all.add(data[i]);
+			if (i + tail >= data.size()) last.add(data[i]);
 		}
-		stat.total = std::max(stat.total, stat.data.size());
-		stat.count = stat.data.size();
-		return in;
 	}
 
+	static constexpr size_t max_pool = 64;
+	static constexpr size_t min_moves = 256;
+
 private:
 	size_t total;
 	size_t block;
 	size_t limit;
 	size_t count;
+	bool record;
 	std::deque<episode> data;
+	std::vector<episode> pool; // retired episodes whose move buffers are reused
+	size_t longest = min_moves; // the longest game observed, for sizing the move buffers
+	tally last, all;
+	counters::values origin, mark, recent; // the counters when started, when the last block is shown, and of the last block
+	std::ostream* json_out = nullptr;
 };
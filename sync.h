@@ -0,0 +1,492 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * sync.h: Parameter server for training weight tables across processes
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <functional>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <csignal>
+#include "weight.h"
+#if defined(__unix__)
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+/**
+ * the messages between the parameter server and its clients
+ *
+ * a message is a header and a payload of count entries, where an entry is a (table, index) key and a value,
+ * sorted by key, and encoded either as the varint of the key difference (compress=varint) or as the raw key,
+ * followed by the float value
+ *
+ * the kinds are
+ * hello: the client sends the table sizes, each as a varint (see encode_sizes), and the server replies with count 1 if they match
+ * sync:  the client sends its deltas since the last sync, and the server replies with the merged values of all
+ *        the entries changed since the epoch of the client (or all the entries if it is too old)
+ */
+class sync_message {
+public:
+	static constexpr uint32_t magic = 0x70737276; // "psrv"
+	enum kind : uint32_t { hello = 1, sync = 2 };
+	static constexpr uint32_t varint = 0x100; // flag of the kind
+
+	struct header {
+		uint32_t magic, kind;
+		uint64_t epoch; // the epoch of the values known by the client
+		uint64_t client, seq; // the client and its sequence number, so that a retried sync is applied once
+		uint64_t count, bytes; // the entries and the bytes of the payload
+	};
+	struct entry {
+		uint64_t key; // table << 32 | index
+		float value;
+		bool operator <(const entry& e) const { return key < e.key; }
+	};
+	static uint64_t key(size_t table, size_t index) { return (uint64_t(table) << 32) | index; }
+	static constexpr uint64_t max_entry = 14; // the bytes of an entry, i.e., a 64-bit varint and a float
+
+	static void encode(std::string& out, const std::vector<entry>& entries, bool compact) {
+		out.clear();
+		uint64_t last = 0;
+		for (const entry& e : entries) {
+			if (compact) {
+				put_varint(out, e.key - last);
+			} else {
+				out.append(reinterpret_cast<const char*>(&e.key), sizeof(e.key));
+			}
+			out.append(reinterpret_cast<const char*>(&e.value), sizeof(e.value));
+			last = e.key;
+		}
+	}
+	static bool decode(const std::string& in, size_t count, bool compact, std::vector<entry>& entries) {
+		entries.clear();
+		entries.reserve(count);
+		const char* it = in.data();
+		const char* end = it + in.size();
+		uint64_t last = 0;
+		for (size_t n = 0; n < count; n++) {
+			entry e;
+			if (compact) {
+				uint64_t v = 0;
+				if (!get_varint(it, end, v)) return false;
+				e.key = last + v;
+			} else {
+				if (end - it < ptrdiff_t(sizeof(e.key))) return false;
+				std::memcpy(&e.key, it, sizeof(e.key));
+				it += sizeof(e.key);
+			}
+			if (end - it < ptrdiff_t(sizeof(e.value))) return false;
+			std::memcpy(&e.value, it, sizeof(e.value));
+			it += sizeof(e.value);
+			entries.push_back(e);
+			last = e.key;
+		}
+		return it == end;
+	}
+
+	/**
+	 * the table sizes of a hello, which are exact at any size, unlike float values
+	 */
+	static void encode_sizes(std::string& out, const std::vector<uint64_t>& sizes) {
+		out.clear();
+		for (uint64_t size : sizes) put_varint(out, size);
+	}
+	static bool decode_sizes(const std::string& in, size_t count, std::vector<uint64_t>& sizes) {
+		sizes.clear();
+		const char* it = in.data();
+		const char* end = it + in.size();
+		for (size_t n = 0; n < count; n++) {
+			uint64_t size = 0;
+			if (!get_varint(it, end, size)) return false;
+			sizes.push_back(size);
+		}
+		return it == end;
+	}
+
+	static void put_varint(std::string& out, uint64_t v) {
+		for (; ; v >>= 7) {
+			out.push_back(char((v & 0x7f) | (v >= 0x80 ? 0x80 : 0)));
+			if (v < 0x80) break;
+		}
+	}
+	static bool get_varint(const char*& it, const char* end, uint64_t& v) {
+		v = 0;
+		for (unsigned shift = 0; ; shift += 7) {
+			if (it == end || shift > 63) return false;
+			uint8_t b = *it++;
+			v |= uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80)) return true;
+		}
+	}
+
+#if defined(__unix__)
+	static bool send(int fd, const header& head, const std::string& payload) {
+		return write_all(fd, &head, sizeof(head)) && write_all(fd, payload.data(), payload.size());
+	}
+	/**
+	 * receive a message of at most count entries, where a header of more entries or more bytes than
+	 * the entries can take is rejected before anything is allocated
+	 */
+	static bool recv(int fd, header& head, std::string& payload, uint64_t count) {
+		if (!read_all(fd, &head, sizeof(head)) || head.magic != magic) return false;
+		if (head.count > count || head.bytes > head.count * max_entry) return false;
+		payload.resize(head.bytes);
+		return read_all(fd, &payload[0], payload.size());
+	}
+	static bool write_all(int fd, const void* data, size_t size) {
+		for (const char* p = static_cast<const char*>(data); size; ) {
+			ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+			if (n <= 0) return false;
+			p += n, size -= n;
+		}
+		return true;
+	}
+	static bool read_all(int fd, void* data, size_t size) {
+		for (char* p = static_cast<char*>(data); size; ) {
+			ssize_t n = ::recv(fd, p, size, 0);
+			if (n <= 0) return false;
+			p += n, size -= n;
+		}
+		return true;
+	}
+#endif
+};
+
+/**
+ * parameter server of weight tables, which merges the deltas pushed by the clients
+ *
+ * the deltas are averaged over the connected clients by default (mean), or summed (sum), where summing
+ * overshoots the entries updated by all the clients toward the same targets during a sync interval, i.e.,
+ * N clients move such an entry N times as far, which diverges for a long interval
+ *
+ * the changed keys of each epoch (one per applied sync) are kept in a bounded journal,
+ * so that a client pulls only the entries changed since its last sync
+ */
+class parameter_server {
+public:
+	parameter_server(std::vector<weight>& net, bool mean = true, size_t journal_limit = size_t(1) << 22)
+		: net(net), mean(mean), clients(1), epoch(1), oldest(1), limit(journal_limit) {}
+
+	/**
+	 * serve the clients on a port until interrupted (SIGINT or SIGTERM),
+	 * where synced is called after each applied sync, e.g., for checkpoints
+	 */
+	void serve(const std::string& port, std::function<void()> synced = nullptr) {
+#if defined(__unix__)
+		int server = listen_on(port);
+		if (server == -1) {
+			std::cerr << "cannot listen on port: " << port << std::endl;
+			std::exit(-1);
+		}
+		stopped() = 0;
+		std::signal(SIGINT, stop);
+		std::signal(SIGTERM, stop);
+		std::cerr << "serving " << net.size() << " tables on port " << port << std::endl;
+		std::vector<pollfd> fds = { { server, POLLIN, 0 } };
+		while (!stopped()) {
+			if (poll(fds.data(), fds.size(), 200) <= 0) continue;
+			clients = std::max<size_t>(fds.size() - 1, 1);
+			for (size_t i = fds.size() - 1; i > 0; i--) {
+				if (!fds[i].revents) continue;
+				bool applied = false;
+				if (!(fds[i].revents & POLLIN) || !handle(fds[i].fd, applied)) {
+					close(fds[i].fd);
+					fds.erase(fds.begin() + i);
+				} else if (applied && synced) {
+					synced();
+				}
+			}
+			if (fds[0].revents & POLLIN) {
+				int fd = accept(server, nullptr, nullptr);
+				if (fd != -1) {
+					// a client that stalls within a message is dropped after the timeout, instead of stalling the others
+					int on = 1;
+					timeval timeout = { 1, 0 };
+					setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+					setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+					setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+					fds.push_back({ fd, POLLIN, 0 });
+				}
+			}
+		}
+		for (const pollfd& p : fds) close(p.fd);
+		std::signal(SIGINT, SIG_DFL);
+		std::signal(SIGTERM, SIG_DFL);
+		std::cerr << "served " << (epoch - 1) << " syncs" << std::endl;
+#else
+		std::cerr << "parameter server is not supported" << std::endl;
+		std::exit(-1);
+#endif
+	}
+
+private:
+#if defined(__unix__)
+	static volatile std::sig_atomic_t& stopped() { static volatile std::sig_atomic_t flag = 0; return flag; }
+	static void stop(int) { stopped() = 1; }
+
+	static int listen_on(const std::string& port) {
+		addrinfo hints = {}, *res = nullptr;
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		if (getaddrinfo(nullptr, port.c_str(), &hints, &res) != 0) return -1;
+		int fd = -1;
+		for (addrinfo* ai = res; ai && fd == -1; ai = ai->ai_next) {
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			int on = 1;
+			if (fd != -1) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+			if (fd != -1 && (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 64) != 0)) close(fd), fd = -1;
+		}
+		freeaddrinfo(res);
+		return fd;
+	}
+
+	/**
+	 * handle a message of a client, return false if the connection should be closed
+	 */
+	bool handle(int fd, bool& applied) {
+		sync_message::header head;
+		if (!sync_message::recv(fd, head, payload, entries_of(net))) return false;
+		if ((head.kind & 0xff) == sync_message::hello) {
+			std::vector<uint64_t> sizes;
+			if (!sync_message::decode_sizes(payload, head.count, sizes)) return false;
+			bool match = sizes.size() == net.size();
+			for (size_t i = 0; match && i < net.size(); i++) match = sizes[i] == net[i].size();
+			sync_message::header reply = { sync_message::magic, head.kind, epoch, head.client, head.seq, match ? 1u : 0u, 0 };
+			return sync_message::send(fd, reply, "") && match;
+		}
+		if ((head.kind & 0xff) != sync_message::sync) return false;
+		bool compact = head.kind & sync_message::varint;
+		if (!sync_message::decode(payload, head.count, compact, entries)) return false;
+
+		// apply the deltas, unless the sync is a retry of an applied one
+		uint64_t& seq = applied_seq[head.client];
+		if (head.seq > seq) {
+			for (const sync_message::entry& e : entries)
+				if (!valid(e.key)) return false;
+			epoch++;
+			float scale = mean ? 1.0f / clients : 1.0f;
+			for (const sync_message::entry& e : entries) {
+				weight& w = net[e.key >> 32];
+				w.store(uint32_t(e.key), w[uint32_t(e.key)] + e.value * scale); // marks the line dirty if tracked
+				journal.push_back({ epoch, e.key });
+			}
+			seq = head.seq;
+			applied = true;
+			trim();
+		}
+
+		// reply the entries changed since the epoch of the client, or all the entries
+		entries.clear();
+		if (head.epoch == 0 || head.epoch < oldest) {
+			for (size_t t = 0; t < net.size(); t++)
+				for (size_t i = 0; i < net[t].size(); i++) entries.push_back({ sync_message::key(t, i), net[t][i] });
+		} else {
+			auto since = std::upper_bound(journal.begin(), journal.end(), change{ head.epoch, UINT64_MAX });
+			for (auto it = since; it != journal.end(); it++) entries.push_back({ it->key, 0 });
+			std::sort(entries.begin(), entries.end());
+			entries.erase(std::unique(entries.begin(), entries.end(), [](const sync_message::entry& a, const sync_message::entry& b) { return a.key == b.key; }), entries.end());
+			for (sync_message::entry& e : entries) e.value = net[e.key >> 32][uint32_t(e.key)];
+		}
+		sync_message::encode(payload, entries, compact);
+		sync_message::header reply = { sync_message::magic, head.kind, epoch, head.client, head.seq, entries.size(), payload.size() };
+		return sync_message::send(fd, reply, payload);
+	}
+#endif
+
+	static uint64_t entries_of(const std::vector<weight>& net) {
+		uint64_t num = 0;
+		for (const weight& w : net) num += w.size();
+		return num;
+	}
+	bool valid(uint64_t key) const {
+		return (key >> 32) < net.size() && uint32_t(key) < net[key >> 32].size();
+	}
+	/**
+	 * drop the older half of the journal if it exceeds the limit, where a client older than
+	 * the remaining journal pulls all the entries
+	 */
+	void trim() {
+		if (journal.size() <= limit) return;
+		journal.erase(journal.begin(), journal.begin() + journal.size() / 2);
+		oldest = journal.front().epoch;
+	}
+
+	struct change {
+		uint64_t epoch, key;
+		bool operator <(const change& c) const { return epoch < c.epoch || (epoch == c.epoch && key < c.key); }
+	};
+
+	std::vector<weight>& net;
+	bool mean;
+	size_t clients; // the connected clients
+	uint64_t epoch; // the epoch of the current values
+	uint64_t oldest; // the journal has all the changes after this epoch
+	size_t limit;
+	std::vector<change> journal;
+	std::map<uint64_t, uint64_t> applied_seq;
+	std::vector<sync_message::entry> entries;
+	std::string payload;
+};
+
+/**
+ * client of a parameter server, which tracks the entries updated since the last sync by a bitmap,
+ * and their values at the first update, so that a sync pushes only the deltas of the updated entries
+ * the tables may be interleaved, i.e., entry i of a table is at width * i, while the keys are the dense indices
+ */
+class parameter_client {
+public:
+	parameter_client(const std::string& address, std::vector<weight>& net, bool compact = true, size_t width = 1)
+		: address(address), net(net), compact(compact), width(width), fd(-1), epoch(0), seq(0) {
+		for (const weight& w : net) touched.emplace_back((w.size() / width + 63) / 64, 0), entries += w.size() / width;
+		client = (uint64_t(std::random_device()()) << 32) ^ std::random_device()();
+	}
+	~parameter_client() {
+#if defined(__unix__)
+		if (fd != -1) close(fd);
+#endif
+	}
+
+	/**
+	 * record the value of an entry before its first update since the last sync
+	 */
+	void touch(size_t table, uint32_t index, float base) {
+		uint64_t& word = touched[table][index >> 6];
+		uint64_t bit = uint64_t(1) << (index & 63);
+		if (word & bit) return;
+		word |= bit;
+		bases.push_back({ sync_message::key(table, index), base });
+	}
+
+	/**
+	 * push the deltas and pull the merged values, return whether the sync is done
+	 *
+	 * the deltas of a sync are frozen with its sequence number, so a failed sync is retried with exactly
+	 * the same deltas (which the server applies once), and the updates after them are pushed by the next sync
+	 * the entries updated since the frozen deltas keep their local deltas on top of the pulled values
+	 */
+	bool sync() {
+#if defined(__unix__)
+		if (!pending) freeze();
+		if (fd == -1 && !connect()) return false;
+		uint32_t kind = sync_message::sync | (compact ? sync_message::varint : 0);
+		sync_message::header head = { sync_message::magic, kind, epoch, client, seq, frozen_count, frozen.size() };
+		std::string payload;
+		std::vector<sync_message::entry> merged;
+		if (!sync_message::send(fd, head, frozen) || !sync_message::recv(fd, head, payload, entries)
+			|| !sync_message::decode(payload, head.count, head.kind & sync_message::varint, merged)) {
+			close(fd);
+			fd = -1;
+			return false;
+		}
+		std::sort(merged.begin(), merged.end());
+		std::sort(bases.begin(), bases.end());
+		for (const sync_message::entry& e : merged) {
+			if ((e.key >> 32) >= net.size() || uint32_t(e.key) >= net[e.key >> 32].size() / width) continue;
+			weight& w = net[e.key >> 32];
+			size_t i = size_t(uint32_t(e.key)) * width;
+			float local = 0;
+			auto b = std::lower_bound(bases.begin(), bases.end(), e);
+			if (b != bases.end() && b->key == e.key) local = w.load(i) - b->value, b->value = e.value;
+			w.store(i, e.value + local);
+		}
+		epoch = head.epoch;
+		pending = false;
+		syncs++, pushed += frozen_count, pulled += merged.size(), bytes += payload.size();
+		return true;
+#else
+		std::cerr << "parameter server is not supported" << std::endl;
+		return false;
+#endif
+	}
+
+	/**
+	 * the done syncs, the total entries pushed and pulled, and the bytes of the pulled payloads
+	 */
+	size_t syncs = 0, pushed = 0, pulled = 0, bytes = 0;
+
+private:
+#if defined(__unix__)
+	bool connect() {
+		size_t colon = address.rfind(':');
+		if (colon == std::string::npos) return false;
+		std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+		addrinfo hints = {}, *res = nullptr;
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return false;
+		for (addrinfo* ai = res; ai && fd == -1; ai = ai->ai_next) {
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd != -1 && ::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) close(fd), fd = -1;
+		}
+		freeaddrinfo(res);
+		if (fd == -1) return false;
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		// check the table sizes
+		std::vector<uint64_t> sizes;
+		for (const weight& w : net) sizes.push_back(w.size() / width);
+		std::string payload;
+		sync_message::encode_sizes(payload, sizes);
+		sync_message::header head = { sync_message::magic, sync_message::hello, epoch, client, seq, sizes.size(), payload.size() };
+		if (!sync_message::send(fd, head, payload) || !sync_message::recv(fd, head, payload, 1) || head.count != 1) {
+			std::cerr << "parameter server rejected the tables: " << address << std::endl;
+			close(fd);
+			fd = -1;
+			return false;
+		}
+		return true;
+	}
+#endif
+
+	/**
+	 * freeze the deltas of the entries updated since the last frozen ones as the next sequence number,
+	 * and start tracking the updates after them
+	 */
+	void freeze() {
+		std::vector<sync_message::entry> deltas;
+		deltas.reserve(bases.size());
+		for (const sync_message::entry& b : bases) {
+			float delta = net[b.key >> 32].load(size_t(uint32_t(b.key)) * width) - b.value;
+			if (delta != 0) deltas.push_back({ b.key, delta });
+		}
+		std::sort(deltas.begin(), deltas.end());
+		sync_message::encode(frozen, deltas, compact);
+		frozen_count = deltas.size();
+		for (const sync_message::entry& b : bases) touched[b.key >> 32][uint32_t(b.key) >> 6] = 0;
+		bases.clear();
+		seq++;
+		pending = true;
+	}
+
+	std::string address;
+	std::vector<weight>& net;
+	bool compact;
+	size_t width;
+	int fd;
+	uint64_t epoch; // the epoch of the values pulled by the last sync, 0 for none
+	uint64_t client, seq;
+	bool pending = false; // whether the frozen deltas are not yet applied
+	std::string frozen; // the payload of the frozen deltas
+	uint64_t frozen_count = 0;
+	uint64_t entries = 0; // the entries of the tables, i.e., the most entries of a message
+	std::vector<std::vector<uint64_t>> touched;
+	std::vector<sync_message::entry> bases; // the entries updated since the last sync, with their values before
+};
@@ -11,19 +11,149 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <map>
+#include <typeinfo>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
 #include "statistics.h"
+#include "runner.h"
+
+/**
+ * the seed given by the arguments of an agent, or the default seed
+ */
+size_t seed_of(const std::string& args) {
+	agent probe("seed=" + std::to_string(random_engine::default_seed) + " " + args);
+	return std::stoull(probe.property("seed"));
+}
+
+/**
+ * evaluate the agents by the unfinished games of the statistics, sharded over the threads
+ *
+ * game i is played with the agents reseeded by the seeds derived from their seeds and i, and the
+ * episodes are added to the statistics in the game order, so the games are the same for any number
+ * of threads, as long as the agents are deterministic given their seeds, e.g., a slider does not learn,
+ * and neither limits its search by time nor shares a transposition table
+ * a game starts only within a few games per thread after the earliest unfinished one, so the finished
+ * games waiting for it are bounded, e.g., when it is a long one
+ */
+template<typename slider, typename placer>
+void evaluate(slider& slide, placer& place, statistics& stats, size_t total, size_t threads, const std::string& slide_args, const std::string& place_args) {
+	size_t slide_seed = seed_of(slide_args), place_seed = seed_of(place_args);
+	std::vector<std::unique_ptr<slider>> slides;
+	std::vector<std::unique_ptr<placer>> places;
+	for (size_t i = 1; i < threads; i++) {
+		slides.emplace_back(static_cast<slider*>(slide.fork(slide_args)));
+		places.emplace_back(static_cast<placer*>(place.fork(place_args)));
+	}
+
+	std::atomic<size_t> games(stats.step());
+	std::map<size_t, episode> done; // the finished games waiting for their preceding games
+	size_t next = stats.step(), window = 4 * threads;
+	std::mutex lock;
+	std::condition_variable ready; // notified when next advances
+	auto worker = [&](slider& slide, placer& place) {
+		game_runner<slider, placer> runner(slide, place);
+		episode game;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			game = stats.acquire();
+		}
+		for (size_t i; (i = games++) < total; ) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				ready.wait(guard, [&]() { return i - next < window; });
+			}
+			slide.notify("seed=" + std::to_string(random_engine::derive(slide_seed, 2 * i)));
+			place.notify("seed=" + std::to_string(random_engine::derive(place_seed, 2 * i + 1)));
+			runner.open();
+			game.open_episode(slide.name() + ":" + place.name());
+			agent& win = runner.play(game);
+			game.close_episode(win.name());
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				done.emplace(i, std::move(game));
+				for (auto it = done.begin(); it != done.end() && it->first == next; it = done.erase(it), next++)
+					stats.add_episode(std::move(it->second));
+				game = stats.acquire();
+			}
+			ready.notify_all();
+			runner.close(win);
+		}
+	};
+	std::vector<std::thread> pool;
+	for (size_t i = 1; i < threads; i++) pool.emplace_back(worker, std::ref(*slides[i - 1]), std::ref(*places[i - 1]));
+	worker(slide, place);
+	for (std::thread& th : pool) th.join();
+}
+
+/**
+ * play the unfinished games of the statistics, with the given slider and placer types
+ */
+template<typename slider, typename placer>
+void play(slider& slide, placer& place, statistics& stats, size_t total, size_t threads, bool eval, const std::string& slide_args, const std::string& place_args) {
+	if (eval) {
+		evaluate(slide, place, stats, total, threads, slide_args, place_args);
+		return;
+	}
+	if (threads > 1) {
+		// each thread plays its own games with its own slider and placer forked from the main ones, where the
+		// sliders share the network of the main slider (if any), and the agents of thread i are seeded with
+		// seed + i, i.e., seed, seed + 1, ..., seed + N - 1
+		size_t slide_seed = seed_of(slide_args), place_seed = seed_of(place_args);
+		std::vector<std::unique_ptr<slider>> slides;
+		std::vector<std::unique_ptr<placer>> places;
+		for (size_t i = 1; i < threads; i++) {
+			slides.emplace_back(static_cast<slider*>(slide.fork(slide_args + " seed=" + std::to_string(slide_seed + i))));
+			places.emplace_back(static_cast<placer*>(place.fork(place_args + " seed=" + std::to_string(place_seed + i))));
+		}
+
+		std::atomic<size_t> games(stats.step());
+		std::mutex lock;
+		auto worker = [&](slider& slide, placer& place) {
+			game_runner<slider, placer> runner(slide, place);
+			episode game;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				game = stats.acquire();
+			}
+			while (games++ < total) {
+				runner.open();
+				game.open_episode(slide.name() + ":" + place.name());
+				agent& win = runner.play(game);
+				game.close_episode(win.name());
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					stats.add_episode(std::move(game));
+					game = stats.acquire(); // reuse the buffer of a retired game
+				}
+				runner.close(win);
+			}
+		};
+		std::vector<std::thread> pool;
+		for (size_t i = 1; i < threads; i++) pool.emplace_back(worker, std::ref(*slides[i - 1]), std::ref(*places[i - 1]));
+		worker(slide, place);
+		for (std::thread& th : pool) th.join();
+	}
+
+	game_runner<slider, placer>(slide, place).run(stats);
+}
 
 int main(int argc, const char* argv[]) {
 	std::cout << "Threes! Demo: ";
 	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
 	std::cout << std::endl;
-	size_t total = 1000, block = 0, limit = 0;
+	size_t total = 1000, block = 0, limit = 0, threads = 1;
+	bool eval = false;
 	std::string slide_args, place_args;
-	std::string load_path, save_path;
+	std::string load_path, save_path, serve_port, json_path;
 	for (int i = 1; i < argc; i++) {
 		std::string arg = argv[i];
 		auto match_arg = [&](std::string flag) -> bool {
@@ -48,46 +178,89 @@ int main(int argc, const char* argv[]) {
 			load_path = next_opt();
 		} else if (match_arg("save")) {
 			save_path = next_opt();
+		} else if (match_arg("json")) {
+			json_path = next_opt();
+		} else if (match_arg("serve")) {
+			serve_port = next_opt();
+		} else if (match_arg("eval-threads")) {
+			threads = std::max<size_t>(std::stoull(next_opt()), 1);
+			eval = true;
+		} else if (match_arg("threads")) {
+			threads = std::max<size_t>(std::stoull(next_opt()), 1);
+		} else if (match_arg("timing")) {
+			episode::timing(next_opt() != "0");
+		}
+	}
+	statistics stats(total, block, limit, save_path.size()); // the episodes are kept only for saving
+	std::ofstream json;
+	if (json_path.size()) {
+		// the blocks are also written as JSON lines, to stdout if the path is -
+		if (json_path != "-") json.open(json_path, std::ios::out | std::ios::app);
+		if (json_path != "-" && !json.is_open()) {
+			std::cerr << "cannot open: " << json_path << std::endl;
+			std::exit(-1);
 		}
+		stats.json(json_path == "-" ? &std::cout : &json);
 	}
-	statistics stats(total, block, limit);
 	if (load_path.size()) {
-		std::ifstream in(load_path, std::ios::in);
-		in >> stats;
+		// the format is detected by the magic of the binary log, otherwise it is the text format
+		std::ifstream in(load_path, std::ios::in | std::ios::binary);
+		if (statistics::is_binary(in)) {
+			if (!stats.load_binary(in, threads)) {
+				std::cerr << "malformed episode log: " << load_path << std::endl;
+				std::exit(-1);
+			}
+		} else {
+			in.close();
+			in.open(load_path, std::ios::in);
+			stats.load_text(in, threads);
+		}
 		in.close();
 		if (stats.is_finished()) stats.summary();
 	}
-	weight_agent slide(slide_args);
-	random_placer place(place_args);
-
-	while (!stats.is_finished()) {
-//		std::cerr << "======== Game " << stats.step() << " ========" << std::endl;
-		slide.open_episode("~:" + place.name());
-		place.open_episode(slide.name() + ":~");
-
-		stats.open_episode(slide.name() + ":" + place.name());
-		episode& game = stats.back();
-		while (true) {
-			agent& who = game.take_turns(slide, place);
-			action move = who.take_action(game.state());
-//			std::cerr << game.state() << "#" << game.step() << " " << who.name() << ": " << move << std::endl;
-			if (game.apply_action(move) != true) break;
-			if (who.check_for_win(game.state())) {
-				slide.last_update();
-				break;
-			}		
+	// the agents are selected by type, where the slider is tdl by default, or expectimax with search=expectimax
+	// the games of the built-in sliders with random_placer are played by a game loop specialized for their types
+	std::string search = agent("search=greedy " + slide_args).property("search");
+	slide_args = (search == "expectimax" ? "type=expectimax " : "type=tdl ") + slide_args;
+	place_args = "type=random " + place_args;
+	std::unique_ptr<agent> slide(agent::create("slider", slide_args));
+	std::unique_ptr<agent> place(agent::create("placer", place_args));
+	weight_agent* learner = dynamic_cast<weight_agent*>(slide.get());
+	if (serve_port.size()) {
+		// serve the network of the slider to the processes training with sync=host:port
+		if (!learner) {
+			std::cerr << "serve requires a slider with weights" << std::endl;
+			std::exit(-1);
 		}
-		agent& win = game.last_turns(slide, place);
-		stats.close_episode(win.name());
-
-		slide.close_episode(win.name());
-		place.close_episode(win.name());
+		learner->serve(serve_port);
+		return 0;
+	}
+	if (eval && learner && learner->learning_rate() != 0) {
+		std::cerr << "eval-threads requires alpha=0" << std::endl;
+		std::exit(-1);
 	}
+	if (typeid(*slide) == typeid(weight_agent) && typeid(*place) == typeid(random_placer)) {
+		play(static_cast<weight_agent&>(*slide), static_cast<random_placer&>(*place), stats, total, threads, eval, slide_args, place_args);
+	} else if (typeid(*slide) == typeid(expectimax_slider) && typeid(*place) == typeid(random_placer)) {
+		play(static_cast<expectimax_slider&>(*slide), static_cast<random_placer&>(*place), stats, total, threads, eval, slide_args, place_args);
+	} else {
+		play(*slide, *place, stats, total, threads, eval, slide_args, place_args);
+	}
+	slide.reset();
+	place.reset();
 
 	if (save_path.size()) {
-		std::ofstream out(save_path, std::ios::out | std::ios::trunc);
-		out << stats;
-		out.close();
+		// the binary log is saved if the path ends with .bin, otherwise the text format
+		bool binary = save_path.size() >= 4 && save_path.compare(save_path.size() - 4, 4, ".bin") == 0;
+		if (binary) {
+			std::ofstream out(save_path, std::ios::out | std::ios::binary | std::ios::trunc);
+			stats.save_binary(out);
+			out.close();
+		} else {
+			std::ofstream out(save_path, std::ios::out | std::ios::trunc);
+			out << stats;
+			out.close();
+		}
 	}
 
 	return 0;
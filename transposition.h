@@ -0,0 +1,131 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * transposition.h: Transposition table for caching the search results
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "board.h"
+
+/**
+ * fixed-size transposition table of search results, i.e., the value, the depth, and the best move
+ *
+ * a board is keyed by a 64-bit hash of its tiles and its info (the hint, the bag, and the last action),
+ * so the boards before and after a slide never collide, as their last actions differ
+ *
+ * the table is lock-free, so it can be shared by multiple threads: an entry is two 64-bit words, the key
+ * xor the data and the data, each stored atomically, so an entry torn by concurrent stores is a miss
+ *
+ * the keys are salted by a generation, so the entries of the earlier generations are all stale after age(),
+ * e.g., when the evaluation changes, without clearing the table
+ */
+class transposition {
+public:
+	struct result {
+		float value;
+		unsigned depth;
+		int move; // -1 if none
+	};
+
+	/**
+	 * a table of (at most) the given bytes, rounded down to a power of two of entries
+	 */
+	transposition(size_t bytes = 0) : mask(0) {
+		size_t len = 1;
+		while (len * 2 * sizeof(entry) <= bytes) len *= 2;
+		table.resize(len);
+		mask = len - 1;
+	}
+
+	/**
+	 * parse a size such as "256M", in bytes with an optional suffix K, M, or G
+	 */
+	static size_t parse(const std::string& size) {
+		size_t end = 0;
+		double num = std::stod(size, &end);
+		switch (end < size.size() ? size[end] : 0) {
+		case 'G': case 'g': num *= 1024;
+		case 'M': case 'm': num *= 1024;
+		case 'K': case 'k': num *= 1024;
+		}
+		return size_t(num);
+	}
+
+	/**
+	 * the number of entries
+	 */
+	size_t size() const { return table.size(); }
+
+	/**
+	 * the cached result of a board, return whether it is found
+	 */
+	bool find(const board& b, result& res) const {
+		uint64_t key = hash(b);
+		const entry& e = table[key & mask];
+		key ^= salt();
+		uint64_t data = __atomic_load_n(&e.data, __ATOMIC_RELAXED);
+		uint64_t check = __atomic_load_n(&e.check, __ATOMIC_RELAXED);
+		if ((check ^ data) != key) return false;
+		uint32_t value = uint32_t(data);
+		std::memcpy(&res.value, &value, sizeof(float));
+		res.depth = (data >> 32) & 0xff;
+		res.move = int((data >> 40) & 0xff) - 1;
+		return true;
+	}
+
+	/**
+	 * cache a result, which replaces the entry unless it is a deeper result of the same board
+	 */
+	void store(const board& b, const result& res) {
+		uint64_t key = hash(b);
+		entry& e = table[key & mask];
+		key ^= salt();
+		uint64_t old = __atomic_load_n(&e.data, __ATOMIC_RELAXED);
+		if ((__atomic_load_n(&e.check, __ATOMIC_RELAXED) ^ old) == key && ((old >> 32) & 0xff) > res.depth) return;
+		uint32_t value;
+		std::memcpy(&value, &res.value, sizeof(float));
+		uint64_t data = uint64_t(value) | (uint64_t(res.depth & 0xff) << 32) | (uint64_t((res.move + 1) & 0xff) << 40);
+		__atomic_store_n(&e.check, key ^ data, __ATOMIC_RELAXED);
+		__atomic_store_n(&e.data, data, __ATOMIC_RELAXED);
+	}
+
+	void clear() {
+		std::fill(table.begin(), table.end(), entry());
+	}
+	void age() {
+		__atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
+	}
+
+	/**
+	 * mix the tiles and the info into a key (the finalizer of MurmurHash3)
+	 */
+	static uint64_t hash(const board& b) {
+		uint64_t h = b.raw() ^ (uint64_t(b.info()) * 0x9e3779b97f4a7c15ull);
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return h;
+	}
+
+private:
+	uint64_t salt() const {
+		return __atomic_load_n(&generation, __ATOMIC_RELAXED) * 0x9e3779b97f4a7c15ull;
+	}
+
+	struct entry {
+		uint64_t check = 0, data = 0;
+	};
+	std::vector<entry> table;
+	size_t mask;
+	uint64_t generation = 0;
+};
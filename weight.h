@@ -10,40 +10,600 @@
 #pragma once
 #include <iostream>
 #include <vector>
+#include <string>
+#include <memory>
 #include <utility>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <fstream>
+#if defined(_WIN32)
+#include <malloc.h>
+#elif defined(__unix__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
+/**
+ * weight table, which either owns its cache-line-aligned memory,
+ * or is a view of a table allocated in an arena (see arena)
+ *
+ * the stores of a tracked table mark their cache lines dirty in a bitmap shared by its views,
+ * which are collected for the incremental snapshots (see weight_file::prepare_delta)
+ */
 class weight {
 public:
 	typedef float type;
+	static constexpr size_t alignment = 64;
 
 public:
-	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
-	weight(const weight& f) = default;
+	weight() : value(nullptr), length(0) {}
+	weight(size_t len) : weight() { allocate(len); }
+	weight(type* data, size_t len, std::shared_ptr<void> mem) : value(data), length(len), mem(mem) {}
+	weight(type* data, size_t len, std::shared_ptr<void> mem, std::shared_ptr<uint64_t> dirty) : value(data), length(len), mem(mem), dirty(dirty) {}
+	weight(weight&& f) noexcept : weight() { swap(f); }
+	weight(const weight& f) : weight(f.size()) { std::copy(f.value, f.value + f.length, value); }
 
-	weight& operator =(const weight& f) = default;
+	weight& operator =(weight f) { swap(f); return *this; }
 	type& operator[] (size_t i) { return value[i]; }
 	const type& operator[] (size_t i) const { return value[i]; }
-	size_t size() const { return value.size(); }
+	size_t size() const { return length; }
+	type* data() { return value; }
+	const type* data() const { return value; }
+
+	/**
+	 * another table sharing the same memory, e.g., for multi-threaded training
+	 */
+	weight view() const { return weight(value, length, mem, dirty); }
+
+	/**
+	 * relaxed atomic access for lock-free (Hogwild-style) training on shared tables,
+	 * where concurrent updates of the same entry may be lost, but never torn
+	 */
+	type load(size_t i) const { type v; __atomic_load(value + i, &v, __ATOMIC_RELAXED); return v; }
+	void store(size_t i, type v) {
+		__atomic_store(value + i, &v, __ATOMIC_RELAXED);
+		if (dirty) mark(i);
+	}
+
+	/**
+	 * track the dirty lines of the table, i.e., the lines of line_size entries (one cache line)
+	 */
+	static constexpr size_t line_size = alignment / sizeof(type);
+	void track() {
+		size_t words = (length + line_size * 64 - 1) / (line_size * 64);
+		dirty = std::shared_ptr<uint64_t>(new uint64_t[std::max<size_t>(words, 1)](), std::default_delete<uint64_t[]>());
+	}
+	bool tracked() const { return dirty != nullptr; }
+	/**
+	 * the dirty lines since the last collection, which are then clean
+	 */
+	std::vector<uint32_t> collect() {
+		std::vector<uint32_t> lines;
+		if (!dirty) return lines;
+		size_t words = (length + line_size * 64 - 1) / (line_size * 64);
+		for (size_t w = 0; w < words; w++) {
+			for (uint64_t bits = __atomic_exchange_n(dirty.get() + w, 0, __ATOMIC_RELAXED); bits; bits &= bits - 1)
+				lines.push_back(uint32_t(w * 64 + __builtin_ctzll(bits)));
+		}
+		return lines;
+	}
+
+	void swap(weight& f) noexcept {
+		std::swap(value, f.value);
+		std::swap(length, f.length);
+		std::swap(mem, f.mem);
+		std::swap(dirty, f.dirty);
+	}
+
+	/**
+	 * zero-initialized aligned memory
+	 */
+	static std::shared_ptr<void> aligned(size_t size, size_t align) {
+		void* ptr = nullptr;
+#if defined(_WIN32)
+		if (!(ptr = _aligned_malloc(std::max<size_t>(size, 1), align))) throw std::bad_alloc();
+		std::shared_ptr<void> mem(ptr, _aligned_free);
+#else
+		if (posix_memalign(&ptr, align, std::max<size_t>(size, 1))) throw std::bad_alloc();
+		std::shared_ptr<void> mem(ptr, std::free);
+#endif
+		std::memset(ptr, 0, size);
+		return mem;
+	}
 
 public:
 	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-		auto& value = w.value;
-		uint64_t size = value.size();
+		uint64_t size = w.size();
 		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-		out.write(reinterpret_cast<const char*>(value.data()), sizeof(type) * size);
+		out.write(reinterpret_cast<const char*>(w.data()), sizeof(type) * size);
 		return out;
 	}
 	friend std::istream& operator >>(std::istream& in, weight& w) {
-		auto& value = w.value;
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-		value.resize(size);
-		in.read(reinterpret_cast<char*>(value.data()), sizeof(type) * size);
+		if (size != w.size()) w = weight(size); // a table of the same size is read in place, e.g., in an arena
+		in.read(reinterpret_cast<char*>(w.data()), sizeof(type) * size);
 		return in;
 	}
 
 protected:
-	std::vector<type> value;
+	void allocate(size_t len) {
+		mem = aligned(sizeof(type) * len, alignment);
+		value = static_cast<type*>(mem.get());
+		length = len;
+	}
+	void mark(size_t i) {
+		uint64_t* word = dirty.get() + i / (line_size * 64);
+		uint64_t bit = uint64_t(1) << ((i / line_size) % 64);
+		if (!(__atomic_load_n(word, __ATOMIC_RELAXED) & bit)) __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+	}
+
+protected:
+	type* value;
+	size_t length;
+	std::shared_ptr<void> mem;
+	std::shared_ptr<uint64_t> dirty; // the bitmap of the dirty lines if tracked
+};
+
+/**
+ * weight table of 16-bit fixed-point entries with a per-table scale, i.e., entry i is data[i] * scale,
+ * which halves the memory of a float table, for evaluation only
+ */
+class quantized {
+public:
+	typedef int16_t type;
+	static constexpr type limit = INT16_MAX;
+
+	quantized() : value(nullptr), length(0), unit(0) {}
+	quantized(type* data, size_t len, float scale, std::shared_ptr<void> mem) : value(data), length(len), unit(scale), mem(mem) {}
+	/**
+	 * quantize a float table by rounding to the nearest step, where the step is max |w| / limit
+	 */
+	explicit quantized(const weight& w) : quantized() {
+		float peak = 0;
+		for (size_t i = 0; i < w.size(); i++) peak = std::max(peak, std::fabs(w[i]));
+		mem = weight::aligned(sizeof(type) * w.size(), weight::alignment);
+		value = static_cast<type*>(mem.get());
+		length = w.size();
+		unit = peak > 0 ? peak / limit : 1;
+		for (size_t i = 0; i < length; i++) value[i] = type(std::lround(w[i] / unit));
+	}
+
+	float operator[] (size_t i) const { return value[i] * unit; }
+	float load(size_t i) const { return value[i] * unit; }
+	size_t size() const { return length; }
+	float scale() const { return unit; }
+	const type* data() const { return value; }
+	quantized view() const { return *this; }
+
+private:
+	type* value;
+	size_t length;
+	float unit;
+	std::shared_ptr<void> mem;
+};
+
+/**
+ * allocate all the weight tables of a network in one contiguous region,
+ * where each table starts at a cache line, and the region is released with the last table
+ *
+ * the modes are
+ * "heap":  separate tables, each with its own aligned allocation
+ * "arena": one anonymous mapping, advised to be backed by transparent huge pages
+ * "huge":  one anonymous mapping of explicit 2MB huge pages (MAP_HUGETLB), falls back to "arena" if
+ *          no huge page is available, e.g., when vm.nr_hugepages is not set
+ *
+ * the mapping is prefaulted by the calling thread, so that the pages are placed on its NUMA node
+ * (the kernel places a page on the node of the thread that first touches it)
+ */
+class arena {
+public:
+	static constexpr size_t huge_page = 2 << 20;
+
+	static std::vector<weight> allocate(const std::vector<size_t>& sizes, const std::string& mode = "heap") {
+		std::vector<weight> net;
+		if (mode == "heap") {
+			for (size_t size : sizes) net.emplace_back(size);
+			return net;
+		}
+		if (mode != "arena" && mode != "huge") {
+			std::cerr << "unknown alloc: " << mode << std::endl;
+			std::exit(-1);
+		}
+
+		std::vector<size_t> offset;
+		size_t total = 0;
+		for (size_t size : sizes) {
+			offset.push_back(total);
+			total += align(sizeof(weight::type) * size, weight::alignment);
+		}
+		std::shared_ptr<void> mem = map(align(std::max<size_t>(total, 1), huge_page), mode == "huge");
+		for (size_t i = 0; i < sizes.size(); i++) {
+			weight::type* data = reinterpret_cast<weight::type*>(static_cast<char*>(mem.get()) + offset[i]);
+			net.emplace_back(data, sizes[i], mem);
+		}
+		return net;
+	}
+
+private:
+	static size_t align(size_t size, size_t unit) {
+		return (size + unit - 1) / unit * unit;
+	}
+
+	static std::shared_ptr<void> map(size_t size, bool huge) {
+#if defined(__unix__) && defined(MAP_ANONYMOUS)
+		void* ptr = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+		if (huge) ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (huge && ptr == MAP_FAILED) std::cerr << "no huge page available, fall back to transparent huge pages" << std::endl;
+#endif
+		if (ptr == MAP_FAILED) {
+			ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (ptr == MAP_FAILED) throw std::bad_alloc();
+#if defined(MADV_HUGEPAGE)
+			madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+		}
+		for (size_t i = 0; i < size; i += 4096) static_cast<volatile char*>(ptr)[i] = 0; // prefault
+		return std::shared_ptr<void>(ptr, [size](void* p) { munmap(p, size); });
+#else
+		return weight::aligned(size, huge_page);
+#endif
+	}
+};
+
+/**
+ * versioned weight file, whose tables can be mapped into memory without copying
+ *
+ * the file is a header, a descriptor of each table (its offset, size, pattern, and scale),
+ * and the tables, each of which starts at a page boundary of the file, whose entries are
+ * either floats or 16-bit fixed-point numbers (see quantized); version 1 files are still readable
+ *
+ * the mapping modes are
+ * "ro":      read-only shared mapping, e.g., for evaluation, where processes on the same host
+ *            share the same physical pages (from the page cache)
+ * "private": copy-on-write mapping, where the updates are never written back to the file
+ * "shared":  writable shared mapping, where the updates go to the file, and are flushed by sync
+ *
+ * a file is saved to a temporary file which then replaces the original one, so that the processes
+ * still mapping the original file are not affected
+ */
+class weight_file {
+public:
+	static constexpr uint32_t magic = 0x74686777; // "wght"
+	static constexpr uint32_t delta_magic = 0x746c6477; // "wdlt"
+	static constexpr uint32_t version = 2; // version 1 has neither the format nor the scales
+	static constexpr size_t page = 4096;
+
+	/**
+	 * the format of the entries, i.e., float (weight) or 16-bit fixed-point (quantized)
+	 */
+	enum format : uint32_t { float32 = 0, int16 = 1 };
+
+	/**
+	 * the pattern of a table, i.e., its number of isomorphisms and up to 6 cells
+	 */
+	struct descriptor {
+		uint8_t iso, length;
+		uint8_t cell[6];
+		bool operator ==(const descriptor& d) const { return std::memcmp(this, &d, sizeof(d)) == 0; }
+		bool operator !=(const descriptor& d) const { return !(*this == d); }
+	};
+
+	/**
+	 * whether a file is in this format, otherwise it may be in the legacy format,
+	 * i.e., the number of tables followed by the tables, each with its size
+	 */
+	static bool probe(const std::string& path) {
+		return read_header(path).magic == magic;
+	}
+	static format probe_format(const std::string& path) {
+		header head = read_header(path);
+		return head.version >= 2 ? format(head.format) : float32;
+	}
+
+	/**
+	 * map the tables of a file, and also return their descriptors
+	 * return an empty network if the file is malformed, cannot be mapped, or is of another format
+	 */
+	static std::vector<weight> load(const std::string& path, std::vector<descriptor>& desc, const std::string& mode = "ro") {
+		std::vector<weight> net;
+		std::vector<table> info;
+		std::shared_ptr<void> mem = map(path, mode, float32, info);
+		if (!mem) return net;
+		desc.clear();
+		for (const table& t : info) {
+			weight::type* data = reinterpret_cast<weight::type*>(static_cast<char*>(mem.get()) + t.offset);
+			net.emplace_back(data, t.size, mem);
+			desc.push_back(t.desc);
+		}
+		return net;
+	}
+	static std::vector<quantized> load_quantized(const std::string& path, std::vector<descriptor>& desc) {
+		std::vector<quantized> net;
+		std::vector<table> info;
+		std::shared_ptr<void> mem = map(path, "ro", int16, info);
+		if (!mem) return net;
+		desc.clear();
+		for (const table& t : info) {
+			quantized::type* data = reinterpret_cast<quantized::type*>(static_cast<char*>(mem.get()) + t.offset);
+			net.emplace_back(data, t.size, t.scale, mem);
+			desc.push_back(t.desc);
+		}
+		return net;
+	}
+
+	/**
+	 * a file prepared to be written without allocating, e.g., by a forked process of a multi-threaded one,
+	 * i.e., the parts written at their offsets of a temporary file which then replaces the path, or
+	 * appended to the path if there is no temporary file
+	 * a part is either the bytes of head from at, or the bytes of data, e.g., of the tables, which must outlive it,
+	 * where the bytes of a strided part are every stride-th float of data, e.g., of interleaved tables
+	 */
+	struct image {
+		struct part {
+			uint64_t offset;
+			const char* data;
+			size_t at, bytes;
+			size_t stride;
+		};
+		std::string path, temp;
+		std::string head;
+		std::vector<part> parts;
+	};
+
+	/**
+	 * save the tables and their descriptors, return whether the file is written
+	 */
+	static bool save(const std::string& path, const std::vector<weight>& net, const std::vector<descriptor>& desc, size_t width = 1) {
+		return write(prepare(path, net, desc, width));
+	}
+	static bool save(const std::string& path, const std::vector<quantized>& net, const std::vector<descriptor>& desc) {
+		return write(prepare(path, net, desc));
+	}
+	/**
+	 * the tables may be interleaved, i.e., entry i of a table is at width * i, which are saved as dense tables
+	 */
+	static image prepare(const std::string& path, const std::vector<weight>& net, const std::vector<descriptor>& desc, size_t width = 1) {
+		std::vector<const char*> data;
+		std::vector<table> info;
+		for (const weight& w : net) {
+			data.push_back(reinterpret_cast<const char*>(w.data()));
+			info.push_back({ 0, w.size() / width, {}, 1 });
+		}
+		return prepare(path, float32, data, info, desc, width);
+	}
+	static image prepare(const std::string& path, const std::vector<quantized>& net, const std::vector<descriptor>& desc) {
+		std::vector<const char*> data;
+		std::vector<table> info;
+		for (const quantized& w : net) {
+			data.push_back(reinterpret_cast<const char*>(w.data()));
+			info.push_back({ 0, w.size(), {}, w.scale() });
+		}
+		return prepare(path, int16, data, info, desc);
+	}
+
+	/**
+	 * append the given lines of the tables (see weight::collect) to a delta log, return whether they are written
+	 *
+	 * the log is a header followed by records, each of which is a run of lines of a table, so it is replayed
+	 * onto the snapshot it is based on by apply_delta, where the later records override the earlier ones
+	 */
+	static bool append_delta(const std::string& path, const std::vector<weight>& net, const std::vector<std::vector<uint32_t>>& lines) {
+		return write(prepare_delta(path, net, lines));
+	}
+	/**
+	 * the lines of interleaved tables (see prepare) are logged as the lines of the dense tables they cover
+	 */
+	static image prepare_delta(const std::string& path, const std::vector<weight>& net, const std::vector<std::vector<uint32_t>>& lines, size_t width = 1) {
+		image img;
+		img.path = path;
+		if (!std::ifstream(path, std::ios::in | std::ios::binary).good()) {
+			header head = { delta_magic, version, uint32_t(net.size()), float32 };
+			img.head.append(reinterpret_cast<const char*>(&head), sizeof(head));
+			img.parts.push_back({ 0, nullptr, 0, sizeof(head), 1 });
+		}
+		for (size_t t = 0; t < net.size() && t < lines.size(); t++) {
+			std::vector<uint32_t> dense;
+			for (uint32_t line : lines[t])
+				if (dense.empty() || dense.back() != line / width) dense.push_back(line / width);
+			for (size_t i = 0; i < dense.size(); ) {
+				size_t j = i + 1;
+				while (j < dense.size() && dense[j] == dense[j - 1] + 1) j++;
+				record rec = { uint32_t(t), dense[i], uint32_t(j - i), 0 };
+				size_t first = size_t(rec.line) * weight::line_size;
+				size_t num = std::min(size_t(rec.lines) * weight::line_size, net[t].size() / width - first);
+				img.parts.push_back({ 0, nullptr, img.head.size(), sizeof(rec), 1 });
+				img.parts.push_back({ 0, reinterpret_cast<const char*>(net[t].data() + first * width), 0, sizeof(weight::type) * num, width });
+				img.head.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+				i = j;
+			}
+		}
+		return img;
+	}
+
+	/**
+	 * write a prepared file (see image), return whether it is written
+	 * only system calls are made, so it can be called by a forked process
+	 */
+	static bool write(const image& img) {
+		bool append = img.temp.empty();
+#if defined(__unix__)
+		int fd = ::open((append ? img.path : img.temp).c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+		if (fd == -1) return false;
+		bool done = true;
+		auto put = [&](const char* data, size_t bytes, uint64_t offset) {
+			for (size_t n = 0; done && n < bytes; ) {
+				ssize_t r = append ? ::write(fd, data + n, bytes - n) : ::pwrite(fd, data + n, bytes - n, off_t(offset + n));
+				done = r > 0;
+				n += done ? size_t(r) : 0;
+			}
+		};
+#else
+		std::ofstream out(append ? img.path : img.temp, std::ios::out | std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+		if (!out.is_open()) return false;
+		auto put = [&](const char* data, size_t bytes, uint64_t offset) {
+			if (!append) out.seekp(offset);
+			out.write(data, bytes);
+		};
+#endif
+		float chunk[1024]; // the floats of a strided part are gathered on the stack, so nothing is allocated
+		for (const image::part& p : img.parts) {
+			const char* data = p.data ? p.data : img.head.data() + p.at;
+			if (p.stride <= 1) {
+				put(data, p.bytes, p.offset);
+				continue;
+			}
+			const float* from = reinterpret_cast<const float*>(data);
+			for (size_t n = 0, num = p.bytes / sizeof(float); n < num; n += 1024) {
+				size_t len = std::min<size_t>(num - n, 1024);
+				for (size_t i = 0; i < len; i++) chunk[i] = from[(n + i) * p.stride];
+				put(reinterpret_cast<const char*>(chunk), len * sizeof(float), p.offset + n * sizeof(float));
+			}
+		}
+#if defined(__unix__)
+		done = ::close(fd) == 0 && done;
+		if (!done) return false;
+#else
+		out.close();
+		if (!out) return false;
+#endif
+		if (append) return true;
+#if defined(_WIN32)
+		std::remove(img.path.c_str()); // rename does not replace an existing file on windows
+#endif
+		return std::rename(img.temp.c_str(), img.path.c_str()) == 0;
+	}
+
+	/**
+	 * replay a delta log onto the tables, return whether it matches the tables
+	 * a truncated record at the end, e.g., of a crash while appending, is ignored
+	 */
+	static bool apply_delta(const std::string& path, std::vector<weight>& net) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		header head = {};
+		if (!in.read(reinterpret_cast<char*>(&head), sizeof(head))) return false;
+		if (head.magic != delta_magic || head.version != version || head.count != net.size()) return false;
+		std::vector<weight::type> buf;
+		for (record rec; in.read(reinterpret_cast<char*>(&rec), sizeof(rec)); ) {
+			size_t first = size_t(rec.line) * weight::line_size;
+			if (rec.table >= net.size() || first >= net[rec.table].size()) return false;
+			size_t num = std::min(size_t(rec.lines) * weight::line_size, net[rec.table].size() - first);
+			buf.resize(num);
+			if (!in.read(reinterpret_cast<char*>(buf.data()), sizeof(weight::type) * num)) break;
+			std::copy(buf.begin(), buf.end(), net[rec.table].data() + first);
+		}
+		return true;
+	}
+
+	/**
+	 * flush the tables of a shared mapping to the file
+	 */
+	static bool sync(const std::vector<weight>& net) {
+		bool done = true;
+#if defined(__unix__)
+		for (const weight& w : net) done &= msync(const_cast<weight::type*>(w.data()), sizeof(weight::type) * w.size(), MS_SYNC) == 0;
+#endif
+		return done;
+	}
+
+private:
+	struct header {
+		uint32_t magic, version;
+		uint32_t count, format;
+	};
+	struct table {
+		uint64_t offset, size;
+		descriptor desc;
+		float scale; // of the quantized entries
+		uint32_t reserved;
+	};
+	struct record {
+		uint32_t table, line, lines, reserved;
+	};
+	struct table_v1 {
+		uint64_t offset, size;
+		descriptor desc;
+	};
+
+	static uint64_t align(uint64_t offset) {
+		return (offset + page - 1) / page * page;
+	}
+	static size_t entry(format fmt) {
+		return fmt == int16 ? sizeof(quantized::type) : sizeof(weight::type);
+	}
+
+	static header read_header(const std::string& path) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		header head = {};
+		in.read(reinterpret_cast<char*>(&head), sizeof(head));
+		return in ? head : header();
+	}
+
+	/**
+	 * map a file of the given format, and also return its table descriptors
+	 */
+	static std::shared_ptr<void> map(const std::string& path, const std::string& mode, format fmt, std::vector<table>& info) {
+		std::shared_ptr<void> mem;
+		size_t size = 0;
+#if defined(__unix__)
+		int fd = open(path.c_str(), mode == "shared" ? O_RDWR : O_RDONLY);
+		if (fd == -1) return mem;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof(header))) {
+			size = st.st_size;
+			int prot = mode == "ro" ? PROT_READ : PROT_READ | PROT_WRITE;
+			void* ptr = mmap(nullptr, size, prot, mode == "private" ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+			if (ptr != MAP_FAILED) mem = std::shared_ptr<void>(ptr, [size](void* p) { munmap(p, size); });
+		}
+		close(fd);
+#else
+		std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+		if (in.is_open() && (size = in.tellg())) {
+			mem = weight::aligned(size, page);
+			in.seekg(0).read(static_cast<char*>(mem.get()), size);
+		}
+#endif
+		if (!mem) return mem;
+
+		const char* base = static_cast<const char*>(mem.get());
+		const header& head = *reinterpret_cast<const header*>(base);
+		if (head.magic != magic || head.version < 1 || head.version > version) return {};
+		format file = head.version >= 2 ? format(head.format) : float32;
+		size_t stride = head.version >= 2 ? sizeof(table) : sizeof(table_v1);
+		if (file != fmt || sizeof(header) + head.count * stride > size) return {};
+		info.clear();
+		for (uint32_t i = 0; i < head.count; i++) {
+			table t = { 0, 0, {}, 1, 0 };
+			std::memcpy(&t, base + sizeof(header) + i * stride, stride);
+			if (t.offset % page || t.offset + t.size * entry(fmt) > size) return {};
+			info.push_back(t);
+		}
+		return mem;
+	}
+
+	static image prepare(const std::string& path, format fmt, const std::vector<const char*>& data, std::vector<table>& info, const std::vector<descriptor>& desc, size_t width = 1) {
+		uint64_t offset = align(sizeof(header) + sizeof(table) * info.size());
+		for (size_t i = 0; i < info.size(); i++) {
+			info[i].offset = offset;
+			info[i].desc = i < desc.size() ? desc[i] : descriptor();
+			offset = align(offset + entry(fmt) * info[i].size);
+		}
+		header head = { magic, version, uint32_t(info.size()), fmt };
+
+		image img;
+		img.path = path;
+		img.temp = path + ".tmp";
+		img.head.append(reinterpret_cast<const char*>(&head), sizeof(head));
+		img.head.append(reinterpret_cast<const char*>(info.data()), sizeof(table) * info.size());
+		img.parts.push_back({ 0, nullptr, 0, img.head.size(), 1 });
+		for (size_t i = 0; i < info.size(); i++) img.parts.push_back({ info[i].offset, data[i], 0, entry(fmt) * info[i].size, width });
+		return img;
+	}
 };